@@ -1,9 +1,31 @@
 #include "pt.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
 uint32_t millis();
 
+/*
+ * Monotonic clock in microseconds, provided by the platform.  It must never
+ * go backwards, and at 64 bits it never wraps in practice.
+ */
+uint64_t micros();
+
+/*
+ * Get the time elapsed since start.  Unsigned subtraction keeps this correct
+ * even if the clock wraps, as long as the interval itself fits.
+ */
+static inline uint64_t pt_time_since(uint64_t start) {
+    return micros() - start;
+}
+
+/*
+ * Check if more than timeout has elapsed since start.
+ */
+static inline bool pt_time_expired(uint64_t start, uint64_t timeout) {
+    return pt_time_since(start) > timeout;
+}
+
 inline unsigned pt_evt_getandclear(uint32_t *events, uint32_t mask) {
     unsigned e = *events & mask;
     *events &= ~mask;
@@ -20,8 +42,8 @@ inline unsigned pt_evt_getandclear(uint32_t *events, uint32_t mask) {
 
 #define PT_EVT_WAIT_TO(pt, events, mask, timeout, result)                                          \
     do {                                                                                           \
-        static unsigned _start;                                                                    \
-        _start = millis();                                                                         \
-        PT_WAIT_UNTIL(pt, (((*result) = ((*events) & (mask))) || (millis() - _start > timeout)));  \
+        static uint64_t _start;                                                                    \
+        _start = micros();                                                                         \
+        PT_WAIT_UNTIL(pt, (((*result) = ((*events) & (mask))) || pt_time_expired(_start, timeout)));\
         (*events) &= ~(mask);                                                                      \
     } while (0)
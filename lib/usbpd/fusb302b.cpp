@@ -15,6 +15,8 @@
  * limitations under the License.
  */
 
+#include <stddef.h>
+
 #include <pd.h>
 
 #include "board.hpp"
@@ -27,6 +29,28 @@ uint32_t millis() {
     return HAL_GetTick();
 }
 
+/*
+ * Default monotonic microsecond clock
+ *
+ * HAL_GetTick() only counts milliseconds, so this is no finer than millis().
+ * Boards with a free-running microsecond timer should define their own
+ * micros() to replace this one, as should host builds that want to drive
+ * time themselves.  The 32-bit tick is extended to 64 bits here, which only
+ * works if this is called at least once per wraparound; pdb_poll does so
+ * every time it runs.
+ */
+__attribute__((weak)) uint64_t micros() {
+    static uint32_t last;
+    static uint64_t high;
+    uint32_t now = HAL_GetTick();
+
+    if (now < last) {
+        high += (uint64_t) 1 << 32;
+    }
+    last = now;
+    return (high + now) * 1000;
+}
+
 /*
  * Read a single byte from the FUSB302B
  *
@@ -88,6 +112,38 @@ static void fusb_write_buf(struct pdb_fusb_config *cfg, uint8_t addr, uint8_t si
     i2c_write(cfg->addr, txbuf, sizeof(txbuf));
 }
 
+/*
+ * Pass a record to the capture callback, if there is one
+ *
+ * cfg: The FUSB302B the record is about
+ * type: The enum pdb_capture_type of the record
+ * payload: The payload of the record
+ * len: The length of the payload, at most 30 bytes
+ */
+static void fusb_capture(struct pdb_fusb_config *cfg, enum pdb_capture_type type,
+                         const uint8_t *payload, uint8_t len) {
+    if (cfg->capture == NULL) {
+        return;
+    }
+
+    uint8_t rec[PDB_CAPTURE_MAX_LEN];
+    uint64_t now = micros();
+    uint64_t delta = TIME_I2MS(now) - TIME_I2MS(cfg->_capture_last_time);
+    cfg->_capture_last_time = now;
+    if (delta > 0xFFFF) {
+        delta = 0xFFFF;
+    }
+
+    rec[0] = PDB_CAPTURE_HDR(type, len);
+    rec[1] = delta & 0xFF;
+    rec[2] = delta >> 8;
+    for (int i = 0; i < len; i++) {
+        rec[3 + i] = payload[i];
+    }
+
+    cfg->capture(cfg->capture_ctx, rec, 3 + len);
+}
+
 static void delay_ms(int delay) {
     HAL_Delay(delay);
 }
@@ -96,48 +152,72 @@ bool fusb_intn_asserted(struct pdb_fusb_config *cfg) {
     return usb_pd_irq_asserted();
 }
 
+/*
+ * Each I2C transaction costs an address byte and a start and stop condition
+ * on top of its data, so messages are moved in as few transactions as the
+ * FIFO allows.  Sending is a single write of up to 40 bytes; at 400 kHz that
+ * takes about 0.9 ms.  Receiving takes two register reads (four transactions):
+ * the token and header, then the data objects and CRC, about 0.9 ms for the
+ * largest message at 400 kHz.  At 100 kHz, multiply by four.
+ */
 void fusb_send_message(struct pdb_fusb_config *cfg, const union pd_msg *msg) {
     /* Token sequences for the FUSB302B */
-    static uint8_t sop_seq[5] = {FUSB_FIFO_TX_SOP1, FUSB_FIFO_TX_SOP1, FUSB_FIFO_TX_SOP1,
-                                 FUSB_FIFO_TX_SOP2, FUSB_FIFO_TX_PACKSYM};
-    static uint8_t eop_seq[4] = {FUSB_FIFO_TX_JAM_CRC, FUSB_FIFO_TX_EOP, FUSB_FIFO_TX_TXOFF,
-                                 FUSB_FIFO_TX_TXON};
-
-    /* Take the I2C2 mutex now so there can't be a race condition on sop_seq */
+    static const uint8_t sop_seq[4] = {FUSB_FIFO_TX_SOP1, FUSB_FIFO_TX_SOP1, FUSB_FIFO_TX_SOP1,
+                                       FUSB_FIFO_TX_SOP2};
+    static const uint8_t eop_seq[4] = {FUSB_FIFO_TX_JAM_CRC, FUSB_FIFO_TX_EOP, FUSB_FIFO_TX_TXOFF,
+                                       FUSB_FIFO_TX_TXON};
 
     /* Get the length of the message: a two-octet header plus NUMOBJ four-octet
      * data objects */
     uint8_t msg_len = 2 + 4 * PD_NUMOBJ_GET(msg);
 
-    /* Set the number of bytes to be transmitted in the packet */
-    sop_seq[4] = FUSB_FIFO_TX_PACKSYM | msg_len;
+    /* Assemble all three parts of the message: the SOP tokens with the
+     * number of bytes to be transmitted in the packet, the message itself,
+     * and the EOP tokens */
+    uint8_t buf[5 + 30 + 4];
+    uint8_t len = 0;
+    for (int i = 0; i < 4; i++) {
+        buf[len++] = sop_seq[i];
+    }
+    buf[len++] = FUSB_FIFO_TX_PACKSYM | msg_len;
+    for (int i = 0; i < msg_len; i++) {
+        buf[len++] = msg->bytes[i];
+    }
+    for (int i = 0; i < 4; i++) {
+        buf[len++] = eop_seq[i];
+    }
+
+    /* Write it to the TX FIFO in one go */
+    fusb_write_buf(cfg, FUSB_FIFOS, len, buf);
 
-    /* Write all three parts of the message to the TX FIFO */
-    fusb_write_buf(cfg, FUSB_FIFOS, 5, sop_seq);
-    fusb_write_buf(cfg, FUSB_FIFOS, msg_len, msg->bytes);
-    fusb_write_buf(cfg, FUSB_FIFOS, 4, eop_seq);
+    fusb_capture(cfg, pdb_capture_tx, msg->bytes, msg_len);
 }
 
 uint8_t fusb_read_message(struct pdb_fusb_config *cfg, union pd_msg *msg) {
-    uint8_t garbage[4];
+    uint8_t buf[4 + 28];
     uint8_t numobj;
 
+    /* Read the token and the message header.  Reading FUSB_FIFOS repeatedly
+     * pops successive bytes from the RX FIFO. */
+    fusb_read_buf(cfg, FUSB_FIFOS, 3, buf);
     /* If this isn't an SOP message, return error.
      * Because of our configuration, we should be able to assume this means the
      * buffer is empty, and not try to read past a non-SOP message. */
-    if ((fusb_read_byte(cfg, FUSB_FIFOS) & FUSB_FIFO_RX_TOKEN_BITS) != FUSB_FIFO_RX_SOP) {
+    if ((buf[0] & FUSB_FIFO_RX_TOKEN_BITS) != FUSB_FIFO_RX_SOP) {
         return 1;
     }
-    /* Read the message header into msg */
-    fusb_read_buf(cfg, FUSB_FIFOS, 2, msg->bytes);
+    msg->bytes[0] = buf[1];
+    msg->bytes[1] = buf[2];
     /* Get the number of data objects */
     numobj = PD_NUMOBJ_GET(msg);
-    /* If there is at least one data object, read the data objects */
-    if (numobj > 0) {
-        fusb_read_buf(cfg, FUSB_FIFOS, numobj * 4, msg->bytes + 2);
+    /* Read the data objects along with the CRC32, which goes in the garbage
+     * since the PHY already checked it. */
+    fusb_read_buf(cfg, FUSB_FIFOS, numobj * 4 + 4, buf);
+    for (int i = 0; i < numobj * 4; i++) {
+        msg->bytes[2 + i] = buf[i];
     }
-    /* Throw the CRC32 in the garbage, since the PHY already checked it. */
-    fusb_read_buf(cfg, FUSB_FIFOS, 4, garbage);
+
+    fusb_capture(cfg, pdb_capture_rx, msg->bytes, 2 + numobj * 4);
 
     return 0;
 }
@@ -145,9 +225,15 @@ uint8_t fusb_read_message(struct pdb_fusb_config *cfg, union pd_msg *msg) {
 void fusb_send_hardrst(struct pdb_fusb_config *cfg) {
     /* Send a hard reset */
     fusb_write_byte(cfg, FUSB_CONTROL3, 0x07 | FUSB_CONTROL3_SEND_HARD_RESET);
+
+    fusb_capture(cfg, pdb_capture_hardrst, NULL, 0);
 }
 
 void fusb_setup(struct pdb_fusb_config *cfg) {
+    /* Start the capture stream's clock */
+    cfg->_capture_last_time = micros();
+    fusb_capture(cfg, pdb_capture_reset, NULL, 0);
+
     /* Fully reset the FUSB302B */
     fusb_write_byte(cfg, FUSB_RESET, FUSB_RESET_SW_RES);
 
@@ -192,6 +278,8 @@ void fusb_setup(struct pdb_fusb_config *cfg) {
 void fusb_get_status(struct pdb_fusb_config *cfg, union fusb_status *status) {
     /* Read the interrupt and status flags into status */
     fusb_read_buf(cfg, FUSB_STATUS0A, 7, status->bytes);
+
+    fusb_capture(cfg, pdb_capture_status, status->bytes, 7);
 }
 
 enum fusb_typec_current fusb_get_typec_current(struct pdb_fusb_config *cfg) {
@@ -209,6 +297,8 @@ void fusb_reset(struct pdb_fusb_config *cfg) {
     fusb_write_byte(cfg, FUSB_CONTROL1, FUSB_CONTROL1_RX_FLUSH);
     /* Reset the PD logic */
     fusb_write_byte(cfg, FUSB_RESET, FUSB_RESET_PD_RESET);
+
+    fusb_capture(cfg, pdb_capture_reset, NULL, 0);
 }
 
 } // extern "C"
@@ -22,10 +22,14 @@
 #include "protocol_rx.h"
 #include "protocol_tx.h"
 #include "fusb302b.h"
+#include "timing.h"
 
 #include "pt.h"
 #include "pt-evt.h"
 
+/* How long to wait for the Policy Engine to finish a hard reset before
+ * carrying on without it.  It normally takes a few polls. */
+#define PDB_T_HARDRST_WAIT_PE TIME_MS2I(100)
 
 /*
  * Hard Reset machine states
@@ -50,6 +54,9 @@ static PT_THREAD(hardrst_reset_layer(struct pt *pt, struct pdb_config *cfg, enum
     static uint32_t evt;
     PT_EVT_WAIT(pt, &cfg->prl.hardrst_events, PDB_EVT_HARDRST_RESET | PDB_EVT_HARDRST_I_HARDRST, &evt);
 
+    /* Nobody has to answer anything sent before the reset */
+    pdb_timing_hard_reset(cfg);
+
     /* Reset the stored message IDs */
     cfg->prl._rx_messageid = 0;
     cfg->prl._tx_messageidcounter = 0;
@@ -65,9 +72,11 @@ static PT_THREAD(hardrst_reset_layer(struct pt *pt, struct pdb_config *cfg, enum
     /* Continue the process based on what event started the reset. */
     if (evt & PDB_EVT_HARDRST_RESET) {
         /* Policy Engine started the reset. */
+        cfg->stats.hard_resets_sent++;
         *res = PRLHRRequestHardReset;
     } else {
         /* PHY started the reset */
+        cfg->stats.hard_resets_received++;
         *res = PRLHRIndicateHardReset;
     }
     PT_END(pt);
@@ -102,6 +111,9 @@ static PT_THREAD(hardrst_wait_phy(struct pt *pt, struct pdb_config *cfg, enum ha
     static uint32_t evt;
     PT_EVT_WAIT_TO(pt, &cfg->prl.hardrst_events, PDB_EVT_HARDRST_I_HARDSENT, PD_T_HARD_RESET_COMPLETE, &evt);
     cfg->pe.events |= PDB_EVT_PE_RESET;
+    if (evt == 0) {
+        cfg->stats.timeouts[pdb_stats_timer_hard_reset_complete]++;
+    }
 
     /* Move on no matter what made us stop waiting. */
     *res = PRLHRHardResetRequested;
@@ -124,7 +136,13 @@ static PT_THREAD(hardrst_wait_pe(struct pt *pt, struct pdb_config *cfg, enum har
     (void) cfg;
     /* Wait for the PE to tell us that it's done */
     static uint32_t evt;
-    PT_EVT_WAIT(pt, &cfg->prl.hardrst_events, PDB_EVT_HARDRST_DONE, &evt);
+    PT_EVT_WAIT_TO(pt, &cfg->prl.hardrst_events, PDB_EVT_HARDRST_DONE, PDB_T_HARDRST_WAIT_PE, &evt);
+
+    /* If the PE never answered, don't wait forever: it may be stuck waiting
+     * for us, and we can't handle any other hard reset until we're done. */
+    if (evt == 0) {
+        cfg->stats.timeouts[pdb_stats_timer_hard_reset_pe]++;
+    }
 
     *res = PRLHRComplete;
     PT_END(pt);
@@ -146,9 +164,11 @@ static PT_THREAD(hardrst_complete(struct pt *pt, struct pdb_config *cfg, enum ha
 static PT_THREAD(HardReset(struct pt *pt, struct pdb_config *cfg))
 {
     PT_BEGIN(pt);
-    static enum hardrst_state state = PRLHRResetLayer;
+    static enum hardrst_state state;
     static struct pt child;
 
+    state = PRLHRResetLayer;
+
     while (true) {
         switch (state) {
             case PRLHRResetLayer:
@@ -69,10 +69,13 @@ static PT_THREAD(IntNPoll(struct pt *pt, struct pdb_config *cfg))
             cfg->prl.hardrst_events |= events;
 
             /* If the I_OCP_TEMP and OVRTEMP flags are set, tell the Policy
-             * Engine thread */
-            if (status.interrupta & FUSB_INTERRUPTA_I_OCP_TEMP
-                    && status.status1 & FUSB_STATUS1_OVRTEMP) {
-                cfg->pe.events |= PDB_EVT_PE_I_OVRTEMP;
+             * Engine thread.  Either way, let it know whether or not we're
+             * still too hot so it knows when to start cooling down. */
+            if (status.interrupta & FUSB_INTERRUPTA_I_OCP_TEMP) {
+                cfg->pe._overtemp = status.status1 & FUSB_STATUS1_OVRTEMP;
+                if (cfg->pe._overtemp) {
+                    cfg->pe.events |= PDB_EVT_PE_I_OVRTEMP;
+                }
             }
 
         }
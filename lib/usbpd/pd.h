@@ -66,6 +66,7 @@
 #define PD_MSGTYPE_FR_SWAP 0x13
 #define PD_MSGTYPE_GET_PPS_STATUS 0x14
 #define PD_MSGTYPE_GET_COUNTRY_CODES 0x15
+#define PD_MSGTYPE_GET_SINK_CAP_EXTENDED 0x16
 /* Data Message */
 #define PD_MSGTYPE_SOURCE_CAPABILITIES 0x01
 #define PD_MSGTYPE_REQUEST 0x02
@@ -74,6 +75,8 @@
 #define PD_MSGTYPE_BATTERY_STATUS 0x05
 #define PD_MSGTYPE_ALERT 0x06
 #define PD_MSGTYPE_GET_COUNTRY_INFO 0x07
+#define PD_MSGTYPE_EPR_REQUEST 0x09
+#define PD_MSGTYPE_EPR_MODE 0x0A
 #define PD_MSGTYPE_VENDOR_DEFINED 0x0F
 /* Extended Message */
 #define PD_MSGTYPE_SOURCE_CAPABILITIES_EXTENDED 0x01
@@ -90,6 +93,9 @@
 #define PD_MSGTYPE_PPS_STATUS 0x0C
 #define PD_MSGTYPE_COUNTRY_INFO 0x0D
 #define PD_MSGTYPE_COUNTRY_CODES 0x0E
+#define PD_MSGTYPE_SINK_CAPABILITIES_EXTENDED 0x0F
+#define PD_MSGTYPE_EXTENDED_CONTROL 0x10
+#define PD_MSGTYPE_EPR_SOURCE_CAPABILITIES 0x11
 
 /* Data roles */
 #define PD_DATAROLE_UFP (0x0 << PD_HDR_DATAROLE_SHIFT)
@@ -132,6 +138,12 @@
 #define PD_CHUNK_NUMBER_GET(msg)                                                                   \
     (((msg)->exthdr & PD_EXTHDR_CHUNK_NUMBER) >> PD_EXTHDR_CHUNK_NUMBER_SHIFT)
 
+/* Extended Control Message types, the first data byte */
+#define PD_EXTCTRL_EPR_GET_SOURCE_CAP 0x01
+#define PD_EXTCTRL_EPR_GET_SINK_CAP 0x02
+#define PD_EXTCTRL_EPR_KEEPALIVE 0x03
+#define PD_EXTCTRL_EPR_KEEPALIVE_ACK 0x04
+
 /*
  * PD Power Data Object
  */
@@ -149,6 +161,19 @@
 
 /* APDO types */
 #define PD_APDO_TYPE_PPS (0x0 << PD_APDO_TYPE_SHIFT)
+#define PD_APDO_TYPE_EPR_AVS (0x1 << PD_APDO_TYPE_SHIFT)
+#define PD_APDO_TYPE_SPR_AVS (0x2 << PD_APDO_TYPE_SHIFT)
+
+/* Check if a PDO is an APDO, i.e. an adjustable supply */
+#define PD_PDO_IS_APDO(pdo) (((pdo)&PD_PDO_TYPE) == PD_PDO_TYPE_AUGMENTED)
+
+/* Check if a PDO is an APDO of a particular type */
+#define PD_APDO_IS_PPS(pdo) (PD_PDO_IS_APDO(pdo) && ((pdo)&PD_APDO_TYPE) == PD_APDO_TYPE_PPS)
+#define PD_APDO_IS_EPR_AVS(pdo)                                                                    \
+    (PD_PDO_IS_APDO(pdo) && ((pdo)&PD_APDO_TYPE) == PD_APDO_TYPE_EPR_AVS)
+#define PD_APDO_IS_SPR_AVS(pdo)                                                                    \
+    (PD_PDO_IS_APDO(pdo) && ((pdo)&PD_APDO_TYPE) == PD_APDO_TYPE_SPR_AVS)
+#define PD_APDO_IS_AVS(pdo) (PD_APDO_IS_EPR_AVS(pdo) || PD_APDO_IS_SPR_AVS(pdo))
 
 /* PD Source Fixed PDO */
 #define PD_PDO_SRC_FIXED_DUAL_ROLE_PWR_SHIFT 29
@@ -163,6 +188,8 @@
 #define PD_PDO_SRC_FIXED_DUAL_ROLE_DATA (1 << PD_PDO_SRC_FIXED_DUAL_ROLE_DATA_SHIFT)
 #define PD_PDO_SRC_FIXED_UNCHUNKED_EXT_MSG_SHIFT 24
 #define PD_PDO_SRC_FIXED_UNCHUNKED_EXT_MSG (1 << PD_PDO_SRC_FIXED_UNCHUNKED_EXT_MSG_SHIFT)
+#define PD_PDO_SRC_FIXED_EPR_CAPABLE_SHIFT 23
+#define PD_PDO_SRC_FIXED_EPR_CAPABLE (1 << PD_PDO_SRC_FIXED_EPR_CAPABLE_SHIFT)
 #define PD_PDO_SRC_FIXED_PEAK_CURRENT_SHIFT 20
 #define PD_PDO_SRC_FIXED_PEAK_CURRENT (0x3 << PD_PDO_SRC_FIXED_PEAK_CURRENT_SHIFT)
 #define PD_PDO_SRC_FIXED_VOLTAGE_SHIFT 10
@@ -203,7 +230,102 @@
 
 #define PD_APDO_PPS_CURRENT_SET(i) (((i) << PD_APDO_PPS_CURRENT_SHIFT) & PD_APDO_PPS_CURRENT)
 
-/* TODO: other types of source PDO */
+/* PD SPR Adjustable Voltage Supply APDO */
+#define PD_APDO_SPR_AVS_PEAK_CURRENT_SHIFT 26
+#define PD_APDO_SPR_AVS_PEAK_CURRENT (0x3 << PD_APDO_SPR_AVS_PEAK_CURRENT_SHIFT)
+#define PD_APDO_SPR_AVS_CURRENT_15V_SHIFT 10
+#define PD_APDO_SPR_AVS_CURRENT_15V (0x3FF << PD_APDO_SPR_AVS_CURRENT_15V_SHIFT)
+#define PD_APDO_SPR_AVS_CURRENT_20V_SHIFT 0
+#define PD_APDO_SPR_AVS_CURRENT_20V (0x3FF << PD_APDO_SPR_AVS_CURRENT_20V_SHIFT)
+
+/* PD SPR Adjustable Voltage Supply APDO currents, for 9-15 V and 15-20 V */
+#define PD_APDO_SPR_AVS_CURRENT_15V_GET(pdo)                                                       \
+    (((pdo)&PD_APDO_SPR_AVS_CURRENT_15V) >> PD_APDO_SPR_AVS_CURRENT_15V_SHIFT)
+#define PD_APDO_SPR_AVS_CURRENT_20V_GET(pdo)                                                       \
+    (((pdo)&PD_APDO_SPR_AVS_CURRENT_20V) >> PD_APDO_SPR_AVS_CURRENT_20V_SHIFT)
+
+#define PD_APDO_SPR_AVS_CURRENT_15V_SET(i)                                                         \
+    (((i) << PD_APDO_SPR_AVS_CURRENT_15V_SHIFT) & PD_APDO_SPR_AVS_CURRENT_15V)
+#define PD_APDO_SPR_AVS_CURRENT_20V_SET(i)                                                         \
+    (((i) << PD_APDO_SPR_AVS_CURRENT_20V_SHIFT) & PD_APDO_SPR_AVS_CURRENT_20V)
+
+/* PD EPR Adjustable Voltage Supply APDO */
+#define PD_APDO_EPR_AVS_PEAK_CURRENT_SHIFT 26
+#define PD_APDO_EPR_AVS_PEAK_CURRENT (0x3 << PD_APDO_EPR_AVS_PEAK_CURRENT_SHIFT)
+#define PD_APDO_EPR_AVS_MAX_VOLTAGE_SHIFT 17
+#define PD_APDO_EPR_AVS_MAX_VOLTAGE (0x1FF << PD_APDO_EPR_AVS_MAX_VOLTAGE_SHIFT)
+#define PD_APDO_EPR_AVS_MIN_VOLTAGE_SHIFT 8
+#define PD_APDO_EPR_AVS_MIN_VOLTAGE (0xFF << PD_APDO_EPR_AVS_MIN_VOLTAGE_SHIFT)
+#define PD_APDO_EPR_AVS_PDP_SHIFT 0
+#define PD_APDO_EPR_AVS_PDP (0xFF << PD_APDO_EPR_AVS_PDP_SHIFT)
+
+/* PD EPR Adjustable Voltage Supply APDO voltages */
+#define PD_APDO_EPR_AVS_MAX_VOLTAGE_GET(pdo)                                                       \
+    (((pdo)&PD_APDO_EPR_AVS_MAX_VOLTAGE) >> PD_APDO_EPR_AVS_MAX_VOLTAGE_SHIFT)
+#define PD_APDO_EPR_AVS_MIN_VOLTAGE_GET(pdo)                                                       \
+    (((pdo)&PD_APDO_EPR_AVS_MIN_VOLTAGE) >> PD_APDO_EPR_AVS_MIN_VOLTAGE_SHIFT)
+
+#define PD_APDO_EPR_AVS_MAX_VOLTAGE_SET(v)                                                         \
+    (((v) << PD_APDO_EPR_AVS_MAX_VOLTAGE_SHIFT) & PD_APDO_EPR_AVS_MAX_VOLTAGE)
+#define PD_APDO_EPR_AVS_MIN_VOLTAGE_SET(v)                                                         \
+    (((v) << PD_APDO_EPR_AVS_MIN_VOLTAGE_SHIFT) & PD_APDO_EPR_AVS_MIN_VOLTAGE)
+
+/* PD EPR Adjustable Voltage Supply APDO power, in watts */
+#define PD_APDO_EPR_AVS_PDP_GET(pdo) (((pdo)&PD_APDO_EPR_AVS_PDP) >> PD_APDO_EPR_AVS_PDP_SHIFT)
+
+#define PD_APDO_EPR_AVS_PDP_SET(w) (((w) << PD_APDO_EPR_AVS_PDP_SHIFT) & PD_APDO_EPR_AVS_PDP)
+
+/* PD Source Variable Supply PDO */
+#define PD_PDO_SRC_VARIABLE_MAX_VOLTAGE_SHIFT 20
+#define PD_PDO_SRC_VARIABLE_MAX_VOLTAGE (0x3FF << PD_PDO_SRC_VARIABLE_MAX_VOLTAGE_SHIFT)
+#define PD_PDO_SRC_VARIABLE_MIN_VOLTAGE_SHIFT 10
+#define PD_PDO_SRC_VARIABLE_MIN_VOLTAGE (0x3FF << PD_PDO_SRC_VARIABLE_MIN_VOLTAGE_SHIFT)
+#define PD_PDO_SRC_VARIABLE_CURRENT_SHIFT 0
+#define PD_PDO_SRC_VARIABLE_CURRENT (0x3FF << PD_PDO_SRC_VARIABLE_CURRENT_SHIFT)
+
+/* PD Source Variable Supply PDO voltages */
+#define PD_PDO_SRC_VARIABLE_MAX_VOLTAGE_GET(pdo)                                                   \
+    (((pdo)&PD_PDO_SRC_VARIABLE_MAX_VOLTAGE) >> PD_PDO_SRC_VARIABLE_MAX_VOLTAGE_SHIFT)
+#define PD_PDO_SRC_VARIABLE_MIN_VOLTAGE_GET(pdo)                                                   \
+    (((pdo)&PD_PDO_SRC_VARIABLE_MIN_VOLTAGE) >> PD_PDO_SRC_VARIABLE_MIN_VOLTAGE_SHIFT)
+
+#define PD_PDO_SRC_VARIABLE_MAX_VOLTAGE_SET(v)                                                     \
+    (((v) << PD_PDO_SRC_VARIABLE_MAX_VOLTAGE_SHIFT) & PD_PDO_SRC_VARIABLE_MAX_VOLTAGE)
+#define PD_PDO_SRC_VARIABLE_MIN_VOLTAGE_SET(v)                                                     \
+    (((v) << PD_PDO_SRC_VARIABLE_MIN_VOLTAGE_SHIFT) & PD_PDO_SRC_VARIABLE_MIN_VOLTAGE)
+
+/* PD Source Variable Supply PDO current */
+#define PD_PDO_SRC_VARIABLE_CURRENT_GET(pdo)                                                       \
+    (((pdo)&PD_PDO_SRC_VARIABLE_CURRENT) >> PD_PDO_SRC_VARIABLE_CURRENT_SHIFT)
+
+#define PD_PDO_SRC_VARIABLE_CURRENT_SET(i)                                                         \
+    (((i) << PD_PDO_SRC_VARIABLE_CURRENT_SHIFT) & PD_PDO_SRC_VARIABLE_CURRENT)
+
+/* PD Source Battery Supply PDO */
+#define PD_PDO_SRC_BATTERY_MAX_VOLTAGE_SHIFT 20
+#define PD_PDO_SRC_BATTERY_MAX_VOLTAGE (0x3FF << PD_PDO_SRC_BATTERY_MAX_VOLTAGE_SHIFT)
+#define PD_PDO_SRC_BATTERY_MIN_VOLTAGE_SHIFT 10
+#define PD_PDO_SRC_BATTERY_MIN_VOLTAGE (0x3FF << PD_PDO_SRC_BATTERY_MIN_VOLTAGE_SHIFT)
+#define PD_PDO_SRC_BATTERY_POWER_SHIFT 0
+#define PD_PDO_SRC_BATTERY_POWER (0x3FF << PD_PDO_SRC_BATTERY_POWER_SHIFT)
+
+/* PD Source Battery Supply PDO voltages */
+#define PD_PDO_SRC_BATTERY_MAX_VOLTAGE_GET(pdo)                                                    \
+    (((pdo)&PD_PDO_SRC_BATTERY_MAX_VOLTAGE) >> PD_PDO_SRC_BATTERY_MAX_VOLTAGE_SHIFT)
+#define PD_PDO_SRC_BATTERY_MIN_VOLTAGE_GET(pdo)                                                    \
+    (((pdo)&PD_PDO_SRC_BATTERY_MIN_VOLTAGE) >> PD_PDO_SRC_BATTERY_MIN_VOLTAGE_SHIFT)
+
+#define PD_PDO_SRC_BATTERY_MAX_VOLTAGE_SET(v)                                                      \
+    (((v) << PD_PDO_SRC_BATTERY_MAX_VOLTAGE_SHIFT) & PD_PDO_SRC_BATTERY_MAX_VOLTAGE)
+#define PD_PDO_SRC_BATTERY_MIN_VOLTAGE_SET(v)                                                      \
+    (((v) << PD_PDO_SRC_BATTERY_MIN_VOLTAGE_SHIFT) & PD_PDO_SRC_BATTERY_MIN_VOLTAGE)
+
+/* PD Source Battery Supply PDO power */
+#define PD_PDO_SRC_BATTERY_POWER_GET(pdo)                                                          \
+    (((pdo)&PD_PDO_SRC_BATTERY_POWER) >> PD_PDO_SRC_BATTERY_POWER_SHIFT)
+
+#define PD_PDO_SRC_BATTERY_POWER_SET(p)                                                            \
+    (((p) << PD_PDO_SRC_BATTERY_POWER_SHIFT) & PD_PDO_SRC_BATTERY_POWER)
 
 /* PD Sink Fixed PDO */
 #define PD_PDO_SNK_FIXED_DUAL_ROLE_PWR_SHIFT 29
@@ -235,7 +357,7 @@
  * PD Request Data Object
  */
 #define PD_RDO_OBJPOS_SHIFT 28
-#define PD_RDO_OBJPOS (0x7 << PD_RDO_OBJPOS_SHIFT)
+#define PD_RDO_OBJPOS ((unsigned)0xF << PD_RDO_OBJPOS_SHIFT)
 #define PD_RDO_GIVEBACK_SHIFT 27
 #define PD_RDO_GIVEBACK (1 << PD_RDO_GIVEBACK_SHIFT)
 #define PD_RDO_CAP_MISMATCH_SHIFT 26
@@ -246,8 +368,10 @@
 #define PD_RDO_NO_USB_SUSPEND (1 << PD_RDO_NO_USB_SUSPEND_SHIFT)
 #define PD_RDO_UNCHUNKED_EXT_MSG_SHIFT 23
 #define PD_RDO_UNCHUNKED_EXT_MSG (1 << PD_RDO_UNCHUNKED_EXT_MSG_SHIFT)
+#define PD_RDO_EPR_CAPABLE_SHIFT 22
+#define PD_RDO_EPR_CAPABLE (1 << PD_RDO_EPR_CAPABLE_SHIFT)
 
-#define PD_RDO_OBJPOS_SET(i) (((i) << PD_RDO_OBJPOS_SHIFT) & PD_RDO_OBJPOS)
+#define PD_RDO_OBJPOS_SET(i) (((uint32_t)(i) << PD_RDO_OBJPOS_SHIFT) & PD_RDO_OBJPOS)
 #define PD_RDO_OBJPOS_GET(msg) (((msg)->obj[0] & PD_RDO_OBJPOS) >> PD_RDO_OBJPOS_SHIFT)
 
 /* Fixed and Variable RDO, no GiveBack support */
@@ -265,7 +389,20 @@
 
 #define PD_RDO_FV_MIN_CURRENT_SET(i) (((i) << PD_RDO_FV_MIN_CURRENT_SHIFT) & PD_RDO_FV_MIN_CURRENT)
 
-/* TODO: Battery RDOs */
+/* Battery RDO, no GiveBack support */
+#define PD_RDO_BATT_POWER_SHIFT 10
+#define PD_RDO_BATT_POWER (0x3FF << PD_RDO_BATT_POWER_SHIFT)
+#define PD_RDO_BATT_MAX_POWER_SHIFT 0
+#define PD_RDO_BATT_MAX_POWER (0x3FF << PD_RDO_BATT_MAX_POWER_SHIFT)
+
+#define PD_RDO_BATT_POWER_SET(p) (((p) << PD_RDO_BATT_POWER_SHIFT) & PD_RDO_BATT_POWER)
+#define PD_RDO_BATT_MAX_POWER_SET(p) (((p) << PD_RDO_BATT_MAX_POWER_SHIFT) & PD_RDO_BATT_MAX_POWER)
+
+/* Battery RDO with GiveBack support */
+#define PD_RDO_BATT_MIN_POWER_SHIFT 0
+#define PD_RDO_BATT_MIN_POWER (0x3FF << PD_RDO_BATT_MIN_POWER_SHIFT)
+
+#define PD_RDO_BATT_MIN_POWER_SET(p) (((p) << PD_RDO_BATT_MIN_POWER_SHIFT) & PD_RDO_BATT_MIN_POWER)
 
 /* Programmable RDO */
 #define PD_RDO_PROG_VOLTAGE_SHIFT 9
@@ -276,22 +413,188 @@
 #define PD_RDO_PROG_VOLTAGE_SET(i) (((i) << PD_RDO_PROG_VOLTAGE_SHIFT) & PD_RDO_PROG_VOLTAGE)
 #define PD_RDO_PROG_CURRENT_SET(i) (((i) << PD_RDO_PROG_CURRENT_SHIFT) & PD_RDO_PROG_CURRENT)
 
+/* Adjustable Voltage Supply RDO */
+#define PD_RDO_AVS_VOLTAGE_SHIFT 9
+#define PD_RDO_AVS_VOLTAGE (0xFFF << PD_RDO_AVS_VOLTAGE_SHIFT)
+#define PD_RDO_AVS_CURRENT_SHIFT 0
+#define PD_RDO_AVS_CURRENT (0x7F << PD_RDO_AVS_CURRENT_SHIFT)
+
+#define PD_RDO_AVS_VOLTAGE_SET(v) (((v) << PD_RDO_AVS_VOLTAGE_SHIFT) & PD_RDO_AVS_VOLTAGE)
+#define PD_RDO_AVS_CURRENT_SET(i) (((i) << PD_RDO_AVS_CURRENT_SHIFT) & PD_RDO_AVS_CURRENT)
+#define PD_RDO_AVS_VOLTAGE_GET(msg)                                                                \
+    (((msg)->obj[0] & PD_RDO_AVS_VOLTAGE) >> PD_RDO_AVS_VOLTAGE_SHIFT)
+#define PD_RDO_AVS_CURRENT_GET(msg)                                                                \
+    (((msg)->obj[0] & PD_RDO_AVS_CURRENT) >> PD_RDO_AVS_CURRENT_SHIFT)
+
+/*
+ * PD EPR Mode Data Object
+ */
+#define PD_EPRMDO_ACTION_SHIFT 24
+#define PD_EPRMDO_ACTION ((unsigned)0xFF << PD_EPRMDO_ACTION_SHIFT)
+#define PD_EPRMDO_DATA_SHIFT 16
+#define PD_EPRMDO_DATA (0xFF << PD_EPRMDO_DATA_SHIFT)
+
+/* EPR Mode actions */
+#define PD_EPRMDO_ACTION_ENTER 0x01
+#define PD_EPRMDO_ACTION_ENTER_ACK 0x02
+#define PD_EPRMDO_ACTION_ENTER_SUCCEEDED 0x03
+#define PD_EPRMDO_ACTION_ENTER_FAILED 0x04
+#define PD_EPRMDO_ACTION_EXIT 0x05
+
+#define PD_EPRMDO_ACTION_SET(a) (((uint32_t)(a) << PD_EPRMDO_ACTION_SHIFT) & PD_EPRMDO_ACTION)
+#define PD_EPRMDO_ACTION_GET(msg) (((msg)->obj[0] & PD_EPRMDO_ACTION) >> PD_EPRMDO_ACTION_SHIFT)
+#define PD_EPRMDO_DATA_SET(d) (((d) << PD_EPRMDO_DATA_SHIFT) & PD_EPRMDO_DATA)
+
+/*
+ * PD Vendor Defined Message Header
+ */
+#define PD_VDM_SVID_SHIFT 16
+#define PD_VDM_SVID ((unsigned)0xFFFF << PD_VDM_SVID_SHIFT)
+#define PD_VDM_STRUCTURED_SHIFT 15
+#define PD_VDM_STRUCTURED (1 << PD_VDM_STRUCTURED_SHIFT)
+#define PD_VDM_VERSION_SHIFT 13
+#define PD_VDM_VERSION (0x3 << PD_VDM_VERSION_SHIFT)
+#define PD_VDM_OBJPOS_SHIFT 8
+#define PD_VDM_OBJPOS (0x7 << PD_VDM_OBJPOS_SHIFT)
+#define PD_VDM_CMDTYPE_SHIFT 6
+#define PD_VDM_CMDTYPE (0x3 << PD_VDM_CMDTYPE_SHIFT)
+#define PD_VDM_CMD_SHIFT 0
+#define PD_VDM_CMD (0x1F << PD_VDM_CMD_SHIFT)
+
+/* Structured VDM versions */
+#define PD_VDM_VERSION_1_0 (0x0 << PD_VDM_VERSION_SHIFT)
+#define PD_VDM_VERSION_2_0 (0x1 << PD_VDM_VERSION_SHIFT)
+
+/* Structured VDM command types */
+#define PD_VDM_CMDTYPE_REQ (0x0 << PD_VDM_CMDTYPE_SHIFT)
+#define PD_VDM_CMDTYPE_ACK (0x1 << PD_VDM_CMDTYPE_SHIFT)
+#define PD_VDM_CMDTYPE_NAK (0x2 << PD_VDM_CMDTYPE_SHIFT)
+#define PD_VDM_CMDTYPE_BUSY (0x3 << PD_VDM_CMDTYPE_SHIFT)
+
+/* Structured VDM commands */
+#define PD_VDM_CMD_DISCOVER_IDENTITY 0x01
+#define PD_VDM_CMD_DISCOVER_SVIDS 0x02
+#define PD_VDM_CMD_DISCOVER_MODES 0x03
+#define PD_VDM_CMD_ENTER_MODE 0x04
+#define PD_VDM_CMD_EXIT_MODE 0x05
+#define PD_VDM_CMD_ATTENTION 0x06
+
+#define PD_VDM_SVID_GET(vdmhdr) (((vdmhdr)&PD_VDM_SVID) >> PD_VDM_SVID_SHIFT)
+#define PD_VDM_SVID_SET(svid) (((uint32_t)(svid) << PD_VDM_SVID_SHIFT) & PD_VDM_SVID)
+#define PD_VDM_CMDTYPE_GET(vdmhdr) ((vdmhdr)&PD_VDM_CMDTYPE)
+#define PD_VDM_CMD_GET(vdmhdr) (((vdmhdr)&PD_VDM_CMD) >> PD_VDM_CMD_SHIFT)
+
+/* Standard IDs */
+#define PD_SVID_PD_SID 0xFF00
+
+/* ID Header VDO */
+#define PD_IDH_USB_HOST ((unsigned)1 << 31)
+#define PD_IDH_USB_DEVICE (1 << 30)
+#define PD_IDH_UFP_TYPE_SHIFT 27
+#define PD_IDH_UFP_TYPE (0x7 << PD_IDH_UFP_TYPE_SHIFT)
+#define PD_IDH_MODAL (1 << 26)
+#define PD_IDH_CONNECTOR_SHIFT 21
+#define PD_IDH_CONNECTOR (0x3 << PD_IDH_CONNECTOR_SHIFT)
+#define PD_IDH_VID_SHIFT 0
+#define PD_IDH_VID (0xFFFF << PD_IDH_VID_SHIFT)
+
+/* Product Types (UFP) */
+#define PD_IDH_UFP_TYPE_NONE (0x0 << PD_IDH_UFP_TYPE_SHIFT)
+#define PD_IDH_UFP_TYPE_HUB (0x1 << PD_IDH_UFP_TYPE_SHIFT)
+#define PD_IDH_UFP_TYPE_PERIPHERAL (0x2 << PD_IDH_UFP_TYPE_SHIFT)
+#define PD_IDH_UFP_TYPE_PSD (0x3 << PD_IDH_UFP_TYPE_SHIFT)
+
+/* Connector Types */
+#define PD_IDH_CONNECTOR_RECEPTACLE (0x2 << PD_IDH_CONNECTOR_SHIFT)
+#define PD_IDH_CONNECTOR_PLUG (0x3 << PD_IDH_CONNECTOR_SHIFT)
+
+#define PD_IDH_VID_SET(vid) (((vid) << PD_IDH_VID_SHIFT) & PD_IDH_VID)
+
+/* Product VDO */
+#define PD_PRODUCT_PID_SHIFT 16
+#define PD_PRODUCT_PID ((unsigned)0xFFFF << PD_PRODUCT_PID_SHIFT)
+#define PD_PRODUCT_BCD_DEVICE_SHIFT 0
+#define PD_PRODUCT_BCD_DEVICE (0xFFFF << PD_PRODUCT_BCD_DEVICE_SHIFT)
+
+#define PD_PRODUCT_PID_SET(pid) (((uint32_t)(pid) << PD_PRODUCT_PID_SHIFT) & PD_PRODUCT_PID)
+#define PD_PRODUCT_BCD_DEVICE_SET(bcd)                                                             \
+    (((bcd) << PD_PRODUCT_BCD_DEVICE_SHIFT) & PD_PRODUCT_BCD_DEVICE)
+
+/*
+ * PD Alert Data Object
+ */
+#define PD_ADO_TYPE_SHIFT 24
+#define PD_ADO_TYPE ((unsigned)0xFF << PD_ADO_TYPE_SHIFT)
+#define PD_ADO_FIXED_BATTERIES_SHIFT 20
+#define PD_ADO_FIXED_BATTERIES (0xF << PD_ADO_FIXED_BATTERIES_SHIFT)
+#define PD_ADO_HOT_SWAP_BATTERIES_SHIFT 16
+#define PD_ADO_HOT_SWAP_BATTERIES (0xF << PD_ADO_HOT_SWAP_BATTERIES_SHIFT)
+#define PD_ADO_EXTENDED_TYPE_SHIFT 0
+#define PD_ADO_EXTENDED_TYPE (0xF << PD_ADO_EXTENDED_TYPE_SHIFT)
+
+/* Type of Alert bits */
+#define PD_ADO_TYPE_BATTERY_STATUS 0x02
+#define PD_ADO_TYPE_OCP 0x04
+#define PD_ADO_TYPE_OTP 0x08
+#define PD_ADO_TYPE_OPERATING_COND 0x10
+#define PD_ADO_TYPE_SOURCE_INPUT 0x20
+#define PD_ADO_TYPE_OVP 0x40
+#define PD_ADO_TYPE_EXTENDED 0x80
+
+/* Type of Alert bits that mean the source had a fault */
+#define PD_ADO_TYPE_FAULT (PD_ADO_TYPE_OCP | PD_ADO_TYPE_OTP | PD_ADO_TYPE_OVP)
+
+#define PD_ADO_TYPE_GET(ado) (((ado)&PD_ADO_TYPE) >> PD_ADO_TYPE_SHIFT)
+
+/*
+ * PD Status Data Block, the data of a Status message
+ */
+#define PD_SDB_INTERNAL_TEMP 0
+#define PD_SDB_PRESENT_INPUT 1
+#define PD_SDB_PRESENT_BATTERY_INPUT 2
+#define PD_SDB_EVENT_FLAGS 3
+#define PD_SDB_TEMPERATURE_STATUS 4
+#define PD_SDB_POWER_STATUS 5
+
+/* Event Flags */
+#define PD_SDB_EVENT_OCP (1 << 1)
+#define PD_SDB_EVENT_OTP (1 << 2)
+#define PD_SDB_EVENT_OVP (1 << 3)
+#define PD_SDB_EVENT_CF (1 << 4)
+
+/* Temperature Status */
+#define PD_SDB_TEMP_STATUS_SHIFT 1
+#define PD_SDB_TEMP_STATUS (0x3 << PD_SDB_TEMP_STATUS_SHIFT)
+#define PD_SDB_TEMP_STATUS_NOT_SUPPORTED (0x0 << PD_SDB_TEMP_STATUS_SHIFT)
+#define PD_SDB_TEMP_STATUS_NORMAL (0x1 << PD_SDB_TEMP_STATUS_SHIFT)
+#define PD_SDB_TEMP_STATUS_WARNING (0x2 << PD_SDB_TEMP_STATUS_SHIFT)
+#define PD_SDB_TEMP_STATUS_OVER (0x3 << PD_SDB_TEMP_STATUS_SHIFT)
+
 /*
  * Time values
  *
- * Where a range is specified, the middle of the range (rounded down to the
- * nearest millisecond) is used.
+ * Intervals are in microseconds, to match micros().  Where a range is
+ * specified, the middle of the range (rounded down to the nearest
+ * millisecond) is used.
  */
 
-#define TIME_MS2I(ms) ms
-#define TIME_S2I(s) (s * 1000)
+#define TIME_US2I(us) ((uint64_t) (us))
+#define TIME_MS2I(ms) TIME_US2I((uint64_t) (ms) * 1000)
+#define TIME_S2I(s) TIME_MS2I((uint64_t) (s) * 1000)
+#define TIME_I2MS(i) ((i) / 1000)
 
+#define PD_T_CHUNK_SENDER_RESPONSE TIME_MS2I(27)
+#define PD_T_CHUNK_SENDER_REQUEST TIME_MS2I(27)
 #define PD_T_CHUNKING_NOT_SUPPORTED TIME_MS2I(45)
+#define PD_T_ENTER_EPR TIME_MS2I(500)
 #define PD_T_HARD_RESET_COMPLETE TIME_MS2I(4)
 #define PD_T_PS_TRANSITION TIME_MS2I(500)
+#define PD_T_RECEIVER_RESPONSE TIME_MS2I(15)
 #define PD_T_SENDER_RESPONSE TIME_MS2I(27)
+#define PD_T_SINK_EPR_KEEPALIVE TIME_MS2I(375)
 #define PD_T_SINK_REQUEST TIME_MS2I(100)
 #define PD_T_TYPEC_SINK_WAIT_CAP TIME_MS2I(465)
+#define PD_T_VDM_RECEIVER_RESPONSE TIME_MS2I(15)
 #define PD_T_PPS_REQUEST TIME_S2I(10)
 /* This is actually from Type-C, not Power Delivery, but who cares? */
 #define PD_T_PD_DEBOUNCE TIME_MS2I(15)
@@ -304,9 +607,14 @@
 /*
  * Value parameters
  */
+#define PD_MV_VSAFE5V 5000
+#define PD_MV_SPR_AVS_MIN 9000
+#define PD_MV_SPR_AVS_15V 15000
+#define PD_MV_SPR_AVS_MAX 20000
 #define PD_MAX_EXT_MSG_LEN 260
 #define PD_MAX_EXT_MSG_CHUNK_LEN 26
 #define PD_MAX_EXT_MSG_LEGACY_LEN 26
+#define PD_MAX_EPR_PDOS 13
 
 /*
  * Unit conversions
@@ -317,6 +625,7 @@
  * PRV: Programmable RDO voltage unit (20 mV)
  * PDV: Power Delivery voltage unit (50 mV)
  * PAV: PPS APDO voltage unit (100 mV)
+ * ARV: AVS RDO voltage unit (25 mV, in steps of 100 mV)
  *
  * A: ampere
  * CA: centiampere
@@ -327,6 +636,7 @@
  * W: watt
  * CW: centiwatt
  * MW: milliwatt
+ * PDW: Power Delivery power unit (250 mW)
  *
  * O: ohm
  * CO: centiohm
@@ -338,6 +648,8 @@
 #define PD_PRV2MV(prv) ((prv)*20)
 #define PD_PDV2MV(pdv) ((pdv)*50)
 #define PD_PAV2MV(pav) ((pav)*100)
+#define PD_MV2ARV(mv) (((mv) / 100) * 4)
+#define PD_ARV2MV(arv) ((arv)*25)
 
 #define PD_MA2CA(ma) (((ma) + 10 - 1) / 10)
 #define PD_MA2PDI(ma) (((ma) + 10 - 1) / 10)
@@ -348,6 +660,9 @@
 #define PD_PAI2CA(pai) ((pai)*5)
 
 #define PD_MW2CW(mw) ((mw) / 10)
+#define PD_MW2PDW(mw) ((mw) / 250)
+#define PD_PDW2MW(pdw) ((pdw)*250)
+#define PD_PDW2CW(pdw) ((pdw)*25)
 
 #define PD_MO2CO(mo) ((mo) / 10)
 
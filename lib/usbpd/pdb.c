@@ -16,33 +16,154 @@
  */
 
 #include <pdb.h>
+
+#include <string.h>
+
 #include "policy_engine.h"
 #include "protocol_rx.h"
 #include "protocol_tx.h"
 #include "hard_reset.h"
 #include "int_n.h"
+#include "pps.h"
+#include "timing.h"
 #include "fusb302b.h"
 
 
+#ifdef PDB_POLL_PROFILE
+/*
+ * Run one part of pdb_poll, timing it.  events is the thread's event
+ * variable, recorded with the longest run.
+ */
+#define PDB_PROFILE_RUN(cfg, part, events, call) \
+    do { \
+        uint32_t _events = (events); \
+        uint32_t _start = pdb_profile_cycles(); \
+        call; \
+        pdb_profile_record(&(cfg)->profile.parts[(part)], _start, _events); \
+    } while (0)
+
+static void pdb_profile_record(struct pdb_profile_stats *stats, uint32_t start,
+        uint32_t events)
+{
+    uint32_t cycles = pdb_profile_cycles() - start;
+
+    stats->runs++;
+    stats->last = cycles;
+    if (cycles > stats->max) {
+        stats->max = cycles;
+        stats->max_events = events;
+    }
+
+    /* Find the bucket: the number of bits needed to hold cycles */
+    uint8_t bucket = 0;
+    while (cycles > 0 && bucket < PDB_PROFILE_NUM_BUCKETS - 1) {
+        cycles >>= 1;
+        bucket++;
+    }
+    stats->hist[bucket]++;
+}
+#else
+#define PDB_PROFILE_RUN(cfg, part, events, call) call
+#endif
+
+void pdb_profile_reset(struct pdb_config *cfg)
+{
+    memset(&cfg->profile, 0, sizeof(cfg->profile));
+}
+
+uint32_t pdb_profile_percentile(const struct pdb_profile_stats *stats,
+        uint8_t pct)
+{
+    if (stats->runs == 0) {
+        return 0;
+    }
+
+    /* Find the first bucket at which pct percent of the runs are counted */
+    uint64_t wanted = ((uint64_t) stats->runs * pct + 99) / 100;
+    uint64_t seen = 0;
+    for (uint8_t i = 0; i < PDB_PROFILE_NUM_BUCKETS - 1; i++) {
+        seen += stats->hist[i];
+        if (seen >= wanted) {
+            return ((uint32_t) 1 << i) - 1;
+        }
+    }
+    /* The last bucket has no upper bound but the longest run */
+    return stats->max;
+}
+
+void pdb_stats_reset(struct pdb_config *cfg)
+{
+    memset(&cfg->stats, 0, sizeof(cfg->stats));
+}
+
 void pdb_init(struct pdb_config *cfg)
 {
+    /* Start every thread from the beginning with no events pending, so that
+     * pdb_init can also be used to start a new session from scratch */
+    PT_INIT(&cfg->int_n.thread);
+    cfg->int_n.events = 0;
+    PT_INIT(&cfg->prl.rx_thread);
+    cfg->prl.rx_events = 0;
+    PT_INIT(&cfg->pe.thread);
+    cfg->pe.events = 0;
+    PT_INIT(&cfg->prl.tx_thread);
+    cfg->prl.tx_events = 0;
+    PT_INIT(&cfg->prl.hardrst_thread);
+    cfg->prl.hardrst_events = 0;
+
+    /* Forget any message that was being transmitted, and the message IDs of
+     * the old session, so nothing from it leaks into the new one */
+    cfg->prl._tx_message = NULL;
+    cfg->prl._rx_messageid = -1;
+    cfg->prl._tx_messageidcounter = 0;
+
+    /* Start counting from zero */
+    pdb_stats_reset(cfg);
+    pdb_timing_init(cfg);
+
+    /* Stop the PPS controller until it's given a new setpoint */
+    pdb_pps_stop(cfg);
+
+    pdb_profile_reset(cfg);
+
     /* Initialize the FUSB302B */
     fusb_setup(&cfg->fusb);
 }
 
 void pdb_poll(struct pdb_config *cfg)
 {
+#ifdef PDB_POLL_PROFILE
+    uint32_t pe_events = cfg->pe.events;
+    uint32_t start = pdb_profile_cycles();
+#endif
+
+    /* Check how long the main loop took to call us again. */
+    pdb_timing_poll(cfg);
+
     /* Schedule the INT_N thread. */
-    pdb_int_n_run(cfg);
+    PDB_PROFILE_RUN(cfg, pdb_profile_int_n, cfg->int_n.events,
+            pdb_int_n_run(cfg));
 
     /* Schedule RX before PE. */
-    pdb_prlrx_run(cfg);
+    PDB_PROFILE_RUN(cfg, pdb_profile_prlrx, cfg->prl.rx_events,
+            pdb_prlrx_run(cfg));
+
+    /* Run the PPS controller before PE so its requests are seen right away. */
+    PDB_PROFILE_RUN(cfg, pdb_profile_pps, cfg->pe.events,
+            pdb_pps_run(cfg));
 
     /* Schedule the policy engine thread. */
-    pdb_pe_run(cfg);
+    PDB_PROFILE_RUN(cfg, pdb_profile_pe, cfg->pe.events,
+            pdb_pe_run(cfg));
 
     /* Schedule TX after PE. */
-    pdb_prltx_run(cfg);
+    PDB_PROFILE_RUN(cfg, pdb_profile_prltx, cfg->prl.tx_events,
+            pdb_prltx_run(cfg));
+
+    PDB_PROFILE_RUN(cfg, pdb_profile_hardrst, cfg->prl.hardrst_events,
+            pdb_hardrst_run(cfg));
 
-    pdb_hardrst_run(cfg);
+#ifdef PDB_POLL_PROFILE
+    pdb_profile_record(&cfg->profile.parts[pdb_profile_poll], start, pe_events);
+#endif
 }
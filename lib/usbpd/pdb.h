@@ -26,7 +26,13 @@
 #include <pdb_int_n.h>
 #include <pdb_msg.h>
 #include <pdb_pe.h>
+#include <pdb_pkt.h>
+#include <pdb_pps.h>
+#include <pdb_profile.h>
+#include <pdb_stats.h>
+#include <pdb_timing.h>
 #include <pdb_prl.h>
+#include <pdb_vdm.h>
 
 #include <stddef.h>
 
@@ -50,6 +56,21 @@ struct pdb_config {
     struct pdb_dpm_callbacks dpm;
     /* Pointer to port-specific DPM data */
     void *dpm_data;
+    /* Structured VDM responder configuration */
+    struct pdb_vdm_config vdm;
+    /* Handlers for messages the library doesn't handle itself, consulted in
+     * the Ready state */
+    const struct pdb_msg_handler *msg_handlers;
+    /* The number of entries in msg_handlers */
+    uint8_t num_msg_handlers;
+    /* Ring buffer to capture every packet sent and received into, or NULL */
+    struct pdb_pkt_ring *pkt_ring;
+    /* Whether or not to send the last accepted Request again, without
+     * calling evaluate_capability, when the source offers the capabilities
+     * it was made from again.  This is typical after a soft or hard reset.
+     * Call pdb_pe_invalidate_caps_cache() whenever the DPM would no longer
+     * make the same Request. */
+    bool reuse_request;
 
     /* Automatically initialized fields */
     /* Policy Engine thread and related variables */
@@ -58,12 +79,25 @@ struct pdb_config {
     struct pdb_prl prl;
     /* INT_N pin thread and related variables */
     struct pdb_int_n int_n;
+    /* PPS controller variables */
+    struct pdb_pps pps;
+    /* Statistics about the PD link */
+    struct pdb_stats stats;
+    /* Timing compliance monitor variables */
+    struct pdb_timing timing;
+    /* Execution time statistics for pdb_poll */
+    struct pdb_profile profile;
 };
 
 /*
  * Initialize the PD Buddy firmware library.
  *
  * The I2C driver must already be initialized before calling this function.
+ *
+ * This may be called again at any time to throw away the current session and
+ * start a new one, e.g. after the cable is replugged or between runs of a
+ * simulated source.  The library's threads keep their state in static
+ * variables, so only one struct pdb_config may be polled per program.
  */
 void pdb_init(struct pdb_config *);
 
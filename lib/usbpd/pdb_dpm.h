@@ -19,14 +19,31 @@
 #define PDB_DPM_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include <pdb_fusb.h>
 #include <pdb_msg.h>
+#include <pdb_timing.h>
 
 
 /* Forward declaration of struct pdb_config */
 struct pdb_config;
 
+/* The highest derating level passed to the derate callback */
+#define PDB_DERATE_MAX_LEVEL 3
+
+/*
+ * Kinds of power transition after a Request is accepted
+ */
+enum pdb_transition_type {
+    /* Vbus is moving to a different voltage */
+    pdb_transition_voltage = 0,
+    /* Vbus stays at the same voltage, only the current changes */
+    pdb_transition_current = 1,
+    /* Vbus moves within the PPS APDO we were already using */
+    pdb_transition_pps = 2
+};
+
 /* DPM callback typedefs */
 typedef void (*pdb_dpm_func)(struct pdb_config *);
 typedef bool (*pdb_dpm_eval_cap_func)(struct pdb_config *,
@@ -34,6 +51,24 @@ typedef bool (*pdb_dpm_eval_cap_func)(struct pdb_config *,
 typedef void (*pdb_dpm_get_sink_cap_func)(struct pdb_config *, union pd_msg *);
 typedef bool (*pdb_dpm_giveback_func)(struct pdb_config *);
 typedef bool (*pdb_dpm_tcc_func)(struct pdb_config *, enum fusb_typec_current);
+typedef bool (*pdb_dpm_fallback_func)(struct pdb_config *, uint8_t,
+        union pd_msg *);
+typedef uint16_t (*pdb_dpm_feedback_func)(struct pdb_config *);
+typedef void (*pdb_dpm_transition_type_func)(struct pdb_config *,
+        enum pdb_transition_type);
+typedef bool (*pdb_dpm_ext_msg_func)(struct pdb_config *,
+        const struct pdb_ext_msg *);
+typedef bool (*pdb_dpm_ext_response_func)(struct pdb_config *,
+        const struct pdb_ext_msg *, struct pdb_ext_tx *);
+typedef bool (*pdb_dpm_battery_status_func)(struct pdb_config *, uint8_t,
+        uint32_t *);
+typedef uint8_t (*pdb_dpm_epr_pdp_func)(struct pdb_config *);
+typedef bool (*pdb_dpm_eval_epr_cap_func)(struct pdb_config *,
+        const uint32_t *, uint8_t, union pd_msg *);
+typedef void (*pdb_dpm_derate_func)(struct pdb_config *, uint8_t, union pd_msg *);
+typedef void (*pdb_dpm_alert_func)(struct pdb_config *, uint32_t);
+typedef void (*pdb_dpm_timing_func)(struct pdb_config *, enum pdb_timing_check,
+        uint32_t);
 
 /*
  * PD Buddy firmware library Device Policy Manager callbacks
@@ -117,6 +152,9 @@ struct pdb_dpm_callbacks {
      * transition of Vbus.  This function must determine if a voltage
      * transition is occurring, and if it is, it must reduce the power
      * consumption to the required level.
+     *
+     * This is not called when the Policy Engine knows Vbus stays at the same
+     * voltage, or moves within the PPS APDO we were already using.
      */
     pdb_dpm_func transition_standby;
 
@@ -140,6 +178,159 @@ struct pdb_dpm_callbacks {
      * Optional.  If no special handling is needed, this may be omitted.
      */
     pdb_dpm_func not_supported_received;
+
+    /*
+     * Create the next Request to try after the source rejected one.
+     *
+     * Called when the source sends Reject before we have an explicit
+     * contract.  The second parameter is the rank of the Request wanted,
+     * starting from 1 for the first alternative to the Request made by
+     * evaluate_capability.  The third parameter is a union pd_msg * into
+     * which the Request must be written.
+     *
+     * Returns true if a Request was written, or false if there are no more
+     * acceptable Requests, in which case we wait for new capabilities.
+     *
+     * Optional.  If this is NULL, no alternatives are tried.
+     */
+    pdb_dpm_fallback_func fallback_request;
+
+    /*
+     * Measure the quantity regulated by the PPS controller.
+     *
+     * Returns the measured voltage in millivolts, e.g. the output voltage or
+     * the voltage of a battery being charged.  The PPS controller adjusts
+     * the requested voltage until this matches its target.
+     *
+     * Optional.  If this is NULL, the PPS controller requests its target
+     * voltage directly.
+     */
+    pdb_dpm_feedback_func pps_feedback;
+
+    /*
+     * Prepare for a power transition.
+     *
+     * Called when the source accepts a Request, before transition_standby.
+     * The second parameter tells what kind of transition is happening, so
+     * that a change of current alone doesn't have to interrupt the load.
+     *
+     * Optional.  If nothing special needs to happen, this may be omitted.
+     */
+    pdb_dpm_transition_type_func transition_type;
+
+    /*
+     * Handle a received extended message.
+     *
+     * The second parameter is the complete message, reassembled from all its
+     * chunks.  It is only valid until this function returns.
+     *
+     * Returns true if the message was handled, or false if it isn't
+     * supported, in which case we answer with Not_Supported.
+     *
+     * Optional.  If this is NULL, no extended messages are supported.
+     */
+    pdb_dpm_ext_msg_func extended_msg_received;
+
+    /*
+     * Describe the extended message to send in response to a request.
+     *
+     * The second parameter is the request: Get_Sink_Cap_Extended (with no
+     * data), Get_Battery_Cap or Get_Manufacturer_Info.  The third parameter
+     * is a struct pdb_ext_tx * into which the response must be described.
+     * Its buffer is sent without being copied, so it must stay valid until
+     * the response is sent; a static or const buffer is best.
+     *
+     * Returns true if a response was described, or false to answer with
+     * Not_Supported.
+     *
+     * Optional.  If this is NULL, these requests get Not_Supported.
+     */
+    pdb_dpm_ext_response_func get_extended_response;
+
+    /*
+     * Create a Battery Status Data Object.
+     *
+     * The second parameter is the Battery Status Ref from the
+     * Get_Battery_Status message.  The third parameter is a uint32_t * into
+     * which the BSDO must be written.
+     *
+     * Returns true if a BSDO was written, or false to answer with
+     * Not_Supported.
+     *
+     * Optional.  If this is NULL, Get_Battery_Status gets Not_Supported.
+     */
+    pdb_dpm_battery_status_func get_battery_status;
+
+    /*
+     * Get the power we'd like to have in EPR Mode.
+     *
+     * Returns our Operational PDP in watts, which is sent to the source when
+     * entering EPR Mode, or 0 if we don't want to enter EPR Mode right now.
+     *
+     * Optional.  If this is NULL, we never enter EPR Mode and don't tell the
+     * source we're EPR capable.  If it isn't NULL, evaluate_epr_capability
+     * must be provided as well.
+     */
+    pdb_dpm_epr_pdp_func epr_sink_pdp;
+
+    /*
+     * Evaluate the source's capabilities in EPR Mode.
+     *
+     * Called instead of evaluate_capability while in EPR Mode.  The second
+     * parameter holds the data objects of the EPR_Source_Capabilities
+     * message, and the third is how many there are; positions 1 to 7 are SPR
+     * PDOs and 8 and up are EPR PDOs.  As with evaluate_capability, the
+     * Request must be written into the fourth parameter, but only its RDO
+     * needs to be filled in: the Policy Engine turns it into an EPR_Request
+     * with a copy of the requested PDO.
+     */
+    pdb_dpm_eval_epr_cap_func evaluate_epr_capability;
+
+    /*
+     * Reduce the power we request because the FUSB302B is too hot.
+     *
+     * Called after evaluate_capability or evaluate_epr_capability while
+     * derating.  The second parameter is the derating level, from 1 to
+     * PDB_DERATE_MAX_LEVEL.  The third parameter holds the Request the DPM
+     * made for full power, which must be changed to ask for less.  At the
+     * highest level, the DPM should ask for the least power it can live with.
+     *
+     * Each overtemperature event raises the level by one and renegotiates.
+     * Once the FUSB302B has stayed cool for a while, the level drops by one
+     * and power is renegotiated again, until we're back at full power.
+     *
+     * Optional.  If this is NULL, overtemperature causes a hard reset.
+     */
+    pdb_dpm_derate_func derate;
+
+    /*
+     * Handle an Alert message from the source.
+     *
+     * The second parameter is the Alert Data Object; PD_ADO_TYPE_GET gives
+     * its Type of Alert bits.  This is called as soon as the Alert arrives,
+     * so it's the place to shed load quickly.
+     *
+     * After an alert of an overcurrent, overtemperature or overvoltage fault,
+     * the derating level is raised and power renegotiated, just like after
+     * our own overtemperature, if derate is provided.  Unless the alert is
+     * only about batteries, a Get_Status message is then sent, and the
+     * Status that comes back is passed to extended_msg_received.
+     *
+     * Optional.
+     */
+    pdb_dpm_alert_func alert_received;
+
+    /*
+     * Handle a timing violation.
+     *
+     * Called when we or the source missed one of the deadlines checked by
+     * the timing compliance monitor.  The second parameter says which one,
+     * and the third is how long it took, in microseconds.  The same
+     * measurements are kept in cfg->timing.
+     *
+     * Optional.
+     */
+    pdb_dpm_timing_func timing_violation;
 };
 
 
@@ -26,6 +26,51 @@
 #define FUSB302B10_ADDR 0x24
 #define FUSB302B11_ADDR 0x25
 
+/*
+ * Kinds of record in a capture stream
+ */
+enum pdb_capture_type {
+    /* The FUSB302B was set up or reset.  No payload. */
+    pdb_capture_reset = 0,
+    /* The status and interrupt registers were read.  The payload is the
+     * seven bytes of a union fusb_status. */
+    pdb_capture_status = 1,
+    /* A message was read from the RX FIFO.  The payload is its header and
+     * data objects. */
+    pdb_capture_rx = 2,
+    /* A message was written to the TX FIFO.  The payload is its header and
+     * data objects. */
+    pdb_capture_tx = 3,
+    /* Hard Reset signaling was sent.  No payload. */
+    pdb_capture_hardrst = 4
+};
+
+/*
+ * Capture stream records
+ *
+ * Each record is a header byte holding the record type in its top three bits
+ * and the payload length in its bottom five, then the time since the
+ * previous record in milliseconds as a little-endian 16-bit number
+ * (saturating at 0xFFFF), then the payload.  Times are taken from micros(),
+ * the clock used by the library's timers and timing compliance monitor, and
+ * rounded to whole milliseconds of it so that they don't drift.  Records are at most
+ * PDB_CAPTURE_MAX_LEN bytes long.
+ */
+#define PDB_CAPTURE_HDR(type, len) ((uint8_t) (((type) << 5) | ((len) & 0x1F)))
+#define PDB_CAPTURE_TYPE_GET(hdr) (((hdr) >> 5) & 0x7)
+#define PDB_CAPTURE_LEN_GET(hdr) ((hdr) & 0x1F)
+#define PDB_CAPTURE_MAX_LEN (3 + 30)
+
+/*
+ * Store a capture stream record.
+ *
+ * The first parameter is the capture_ctx from the struct pdb_fusb_config.
+ * The second is the record, and the third its length in bytes.  This is
+ * called in the middle of handling PD messages, so it must be quick: copy
+ * the record to a buffer and write it out later.
+ */
+typedef void (*pdb_capture_func)(void *, const uint8_t *, uint8_t);
+
 /*
  * Configuration for the FUSB302B chip
  */
@@ -34,6 +79,14 @@ struct pdb_fusb_config {
     uint8_t addr;
     /* The INT_N line */
     void *int_n;
+    /* Capture callback for everything the FUSB302B tells us and everything
+     * we send, so a session can be replayed later.  May be NULL. */
+    pdb_capture_func capture;
+    /* Context pointer passed to capture */
+    void *capture_ctx;
+
+    /* Time of the last captured record, from micros() */
+    uint64_t _capture_last_time;
 };
 
 /*
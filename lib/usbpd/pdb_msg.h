@@ -19,9 +19,15 @@
 #define PDB_MSG_H
 
 #include "pt-queue.h"
+#include "pd.h"
 
+#include <stdbool.h>
 #include <stdint.h>
 
+
+/* Forward declaration of struct pdb_config */
+struct pdb_config;
+
 /*
  * PD message union
  *
@@ -52,6 +58,77 @@ union pd_msg {
 
 const extern union pd_msg pd_msg_empty;
 
+/*
+ * Reassembled extended message
+ *
+ * Chunked extended messages are reassembled into this instead of a union
+ * pd_msg so that every message in the mailboxes doesn't grow to the maximum
+ * extended message size.  It costs 264 bytes of RAM per port.
+ */
+struct pdb_ext_msg {
+    /* The message header of the first chunk */
+    uint16_t hdr;
+    /* The number of bytes in data */
+    uint16_t size;
+    uint8_t data[PD_MAX_EXT_MSG_LEN];
+};
+
+/*
+ * Extended message to transmit
+ *
+ * The data is sent straight from the caller's buffer one chunk at a time, so
+ * the buffer must stay valid until the whole message has been sent.
+ */
+struct pdb_ext_tx {
+    /* The extended message type */
+    uint8_t type;
+    /* The number of bytes in data */
+    uint16_t size;
+    const uint8_t *data;
+};
+
+/*
+ * Classes of PD message, which each have their own set of message types
+ */
+enum pdb_msg_class {
+    /* Messages with no data objects */
+    pdb_msg_control = 0,
+    /* Messages with data objects */
+    pdb_msg_data = 1,
+    /* Extended messages */
+    pdb_msg_extended = 2
+};
+
+/* Get the enum pdb_msg_class of a message */
+#define PDB_MSG_CLASS_GET(msg) (((msg)->hdr & PD_HDR_EXT) ? pdb_msg_extended \
+        : (PD_NUMOBJ_GET(msg) > 0) ? pdb_msg_data : pdb_msg_control)
+
+/* The number of message classes and message types per class */
+#define PDB_MSG_NUM_CLASSES 3
+#define PDB_MSG_NUM_TYPES 32
+
+/*
+ * Handle a message the library doesn't handle itself.
+ *
+ * Extended messages are passed as their first chunk.
+ *
+ * Returns true if the message was handled, or false to treat it as an
+ * unknown message, which gets a soft reset.
+ */
+typedef bool (*pdb_msg_handler_func)(struct pdb_config *, const union pd_msg *);
+
+/*
+ * An entry in a table of message handlers
+ */
+struct pdb_msg_handler {
+    /* The class of the message, an enum pdb_msg_class */
+    uint8_t msg_class;
+    /* The message type */
+    uint8_t type;
+    /* The handler */
+    pdb_msg_handler_func handler;
+};
+
 /*
  * Queue type for inter-thread messaging
  */
@@ -30,9 +30,13 @@
  */
 /* Tell the PE to send a Get_Source_Cap message */
 #define PDB_EVT_PE_GET_SOURCE_CAP PDB_EVENT_MASK(7)
-/* Tell the PE that new power is required */
+/* Tell the PE that new power is required.  Prefer pdb_pe_new_power(), which
+ * also counts how many of these are merged together. */
 #define PDB_EVT_PE_NEW_POWER PDB_EVENT_MASK(8)
 
+/* Forward declaration of struct pdb_config */
+struct pdb_config;
+
 /*
  * Structure for Policy Engine thread and variables
  */
@@ -56,15 +60,80 @@ struct pdb_pe {
     bool _min_power;
     /* The number of hard resets we've sent */
     int8_t _hard_reset_counter;
+    /* Whether or not we're recovering from a hard reset */
+    bool _hard_reset_recovering;
+    /* When the hard reset we're recovering from started */
+    uint64_t _hard_reset_start;
     /* The result of the last Type-C Current match comparison */
     int8_t _old_tcc_match;
-    /* The index of the first PPS APDO */
+    /* The index of the first PPS APDO, 0 if there is none */
     uint8_t _pps_index;
-    /* The index of the just-requested PPS APDO */
+    /* The index of the just-requested PPS APDO, 0 if there is none */
     uint8_t _last_pps;
     /* Last time of SinkPPSPeriodicTimer */
-    uint32_t _sink_pps_last_time;
-    /* True if PPS periodic timer active */
-    bool _sink_pps_timer_enabled;
+    uint64_t _sink_apdo_last_time;
+    /* True if SinkPPSPeriodicTimer is running for a PPS or AVS contract */
+    bool _sink_apdo_timer_enabled;
+    /* Fingerprint of the most recent Source_Capabilities */
+    uint32_t _caps_hash;
+    /* Fingerprint of the Source_Capabilities of the last explicit contract */
+    uint32_t _cached_caps_hash;
+    /* The Request that was accepted for those Source_Capabilities */
+    union pd_msg _cached_request;
+    /* Whether or not _cached_request may be sent again */
+    bool _caps_cache_valid;
+    /* The rank of the fallback Request we're trying, 0 for the DPM's first
+     * choice */
+    uint8_t _fallback_rank;
+    /* The number of times we've repeated a Request after a Wait */
+    uint8_t _wait_retries;
+    /* The data objects of the most recent (EPR_)Source_Capabilities */
+    uint32_t _caps[PD_MAX_EPR_PDOS];
+    /* The number of data objects in _caps */
+    uint8_t _caps_numobj;
+    /* The voltage of our current contract, in millivolts */
+    uint16_t _contract_mv;
+    /* The PDO of our current contract, 0 if there is none */
+    uint32_t _contract_pdo;
+    /* The extended message being reassembled */
+    struct pdb_ext_msg _ext_msg;
+    /* Whether or not we asked for the extended message about to be received */
+    bool _ext_solicited;
+    /* The extended message being transmitted */
+    struct pdb_ext_tx _ext_tx;
+    /* Whether or not we're in EPR Mode */
+    bool _epr_mode;
+    /* Whether or not the source refused to let us enter EPR Mode */
+    bool _epr_entry_failed;
+    /* Whether or not _caps holds EPR_Source_Capabilities not yet evaluated */
+    bool _epr_caps_new;
+    /* Last time of SinkEPRKeepAliveTimer */
+    uint64_t _sink_epr_last_time;
+    /* How far we've reduced our power because of overtemperature */
+    uint8_t _derate_level;
+    /* Whether or not the FUSB302B says it's too hot right now */
+    bool _overtemp;
+    /* Last time the FUSB302B was too hot or we stepped power back up */
+    uint64_t _derate_last_time;
+    /* The number of recovery soft resets sent since our last contract */
+    uint8_t _recovery_soft_resets;
+    /* The response to the Vendor_Defined message we just received */
+    union pd_msg _vdm_response;
 };
+
+/*
+ * Tell the Policy Engine that new power is required.
+ *
+ * Any number of calls made before the Policy Engine gets to the first are
+ * served by a single Request, and each extra call is counted in
+ * cfg->stats.coalesced_requests.
+ */
+void pdb_pe_new_power(struct pdb_config *cfg);
+
+/*
+ * Forget the cached Request, so the next Source_Capabilities are evaluated by
+ * the DPM even if they match those of our last explicit contract.
+ */
+void pdb_pe_invalidate_caps_cache(struct pdb_config *cfg);
+
 #endif /* PDB_PE_H */
@@ -0,0 +1,99 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_PKT_H
+#define PDB_PKT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+ * Directions of a captured packet
+ */
+enum pdb_pkt_dir {
+    /* Received from the port partner and passed to the Policy Engine */
+    pdb_pkt_rx = 0,
+    /* Given to the PHY to transmit */
+    pdb_pkt_tx = 1
+};
+
+/*
+ * SOP types of a captured packet
+ *
+ * We only ever send and receive SOP packets, but the field is there so
+ * captures can be merged with those of other tools.
+ */
+enum pdb_pkt_sop {
+    pdb_pkt_sop = 0,
+    pdb_pkt_sop_prime = 1,
+    pdb_pkt_sop_dprime = 2
+};
+
+/*
+ * A captured packet
+ */
+struct pdb_pkt {
+    /* When the packet was captured, from micros(), the clock used by all the
+     * library's timers and by the timing compliance monitor */
+    uint64_t time;
+    /* The enum pdb_pkt_dir of the packet */
+    uint8_t dir;
+    /* The enum pdb_pkt_sop of the packet */
+    uint8_t sop;
+    /* The message header */
+    uint16_t hdr;
+    /* The data objects, or the extended header and data of an extended
+     * message.  Only the first 4 * PD_NUMOBJ_GET bytes are meaningful. */
+    uint32_t obj[7];
+};
+
+/*
+ * Ring buffer of captured packets
+ *
+ * The buffer is provided by the user and never allocated by the library.
+ * Capturing a packet is a fixed-size copy.  When the ring is full, the oldest
+ * packets are overwritten; readers can tell how many they missed.
+ */
+struct pdb_pkt_ring {
+    /* The buffer */
+    struct pdb_pkt *buf;
+    /* The number of packets buf can hold, which must be a nonzero power of
+     * two.  Nothing is captured into a ring of any other size. */
+    uint16_t size;
+    /* The number of packets ever captured */
+    uint32_t w;
+};
+
+/*
+ * Read the next packet from a ring.
+ *
+ * r is the reader's own count of packets read, which starts at 0 and is
+ * updated by this function.  If the reader fell so far behind that packets
+ * were overwritten, it skips to the oldest packet still in the ring and adds
+ * the number of packets skipped to *lost, if lost isn't NULL.
+ *
+ * The ring is only written by pdb_poll, so this must be called between calls
+ * to pdb_poll.
+ *
+ * Returns true if a packet was copied into pkt, or false if there are no new
+ * packets.
+ */
+bool pdb_pkt_read(const struct pdb_pkt_ring *ring, uint32_t *r,
+        struct pdb_pkt *pkt, uint32_t *lost);
+
+#endif /* PDB_PKT_H */
@@ -0,0 +1,67 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_PPS_H
+#define PDB_PPS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Forward declaration of struct pdb_config */
+struct pdb_config;
+
+/*
+ * Structure for the PPS controller variables
+ */
+struct pdb_pps {
+    /* Whether or not the controller is tracking a setpoint */
+    bool _enabled;
+    /* The target voltage, in millivolts */
+    uint16_t _target_mv;
+    /* The target current, in milliamperes */
+    uint16_t _target_ma;
+    /* The Request data object waiting for the Policy Engine */
+    uint32_t _rdo;
+    /* Last time we made a Request */
+    uint64_t _last_time;
+};
+
+/*
+ * Make the PPS controller track a voltage and current.
+ *
+ * The controller makes Programmable Requests from the PPS APDO of the current
+ * contract, or the first PPS APDO if the contract isn't for a PPS APDO.  It
+ * only runs while we have an explicit contract, and it keeps the voltage and
+ * current within the limits of the APDO.  The voltage is adjusted in 20 mV
+ * steps until the DPM's pps_feedback callback measures mv, and the current is
+ * requested in 50 mA steps.
+ *
+ * The DPM's transition_requested callback is called as usual whenever one of
+ * these Requests is accepted.
+ */
+void pdb_pps_set_target(struct pdb_config *cfg, uint16_t mv, uint16_t ma);
+
+/*
+ * Stop the PPS controller.
+ *
+ * The current contract is kept, and PD_T_PPS_REQUEST keep-alive Requests
+ * continue as before.
+ */
+void pdb_pps_stop(struct pdb_config *cfg);
+
+#endif /* PDB_PPS_H */
@@ -0,0 +1,101 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_PROFILE_H
+#define PDB_PROFILE_H
+
+#include <stdint.h>
+
+
+/* Forward declaration of struct pdb_config */
+struct pdb_config;
+
+/*
+ * The parts of pdb_poll that are timed separately
+ */
+enum pdb_profile_part {
+    pdb_profile_int_n = 0,
+    pdb_profile_prlrx = 1,
+    pdb_profile_pps = 2,
+    pdb_profile_pe = 3,
+    pdb_profile_prltx = 4,
+    pdb_profile_hardrst = 5,
+    /* The whole pdb_poll call */
+    pdb_profile_poll = 6
+};
+
+#define PDB_PROFILE_NUM_PARTS 7
+
+/* The number of histogram buckets.  Bucket n counts the runs that took fewer
+ * than 2^n cycles but at least 2^(n-1), and the last bucket counts all longer
+ * runs too. */
+#define PDB_PROFILE_NUM_BUCKETS 20
+
+/*
+ * Execution time statistics for one part of pdb_poll
+ */
+struct pdb_profile_stats {
+    /* The number of runs timed */
+    uint32_t runs;
+    /* The duration of the most recent run, in cycles */
+    uint32_t last;
+    /* The duration of the longest run, in cycles */
+    uint32_t max;
+    /* The thread's events before its longest run.  For pdb_profile_poll,
+     * the Policy Engine's events. */
+    uint32_t max_events;
+    /* Histogram of run durations */
+    uint32_t hist[PDB_PROFILE_NUM_BUCKETS];
+};
+
+/*
+ * Execution time statistics for pdb_poll
+ *
+ * Always present in struct pdb_config, so that its layout doesn't depend on
+ * PDB_POLL_PROFILE, but only filled in when the library is built with
+ * PDB_POLL_PROFILE defined.
+ */
+struct pdb_profile {
+    struct pdb_profile_stats parts[PDB_PROFILE_NUM_PARTS];
+};
+
+/*
+ * Read a free-running cycle counter.
+ *
+ * Must be provided by the platform when PDB_POLL_PROFILE is defined, e.g. by
+ * returning DWT->CYCCNT on a Cortex-M3 or better.  Any counter that wraps
+ * around at 2^32 will do; a microsecond timer works too, with coarser
+ * results.
+ */
+uint32_t pdb_profile_cycles(void);
+
+/*
+ * Clear the execution time statistics.
+ */
+void pdb_profile_reset(struct pdb_config *cfg);
+
+/*
+ * Estimate a percentile of the run durations of one part of pdb_poll.
+ *
+ * pct is the percentile, from 0 to 100.  Returns an upper bound on the
+ * duration in cycles, accurate to within a factor of two, or 0 if there have
+ * been no runs.
+ */
+uint32_t pdb_profile_percentile(const struct pdb_profile_stats *stats,
+        uint8_t pct);
+
+#endif /* PDB_PROFILE_H */
@@ -0,0 +1,117 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_STATS_H
+#define PDB_STATS_H
+
+#include <stdint.h>
+
+#include <pdb_msg.h>
+
+
+/* Forward declaration of struct pdb_config */
+struct pdb_config;
+
+/*
+ * Timers whose expiry is counted in struct pdb_stats
+ */
+enum pdb_stats_timer {
+    /* SinkWaitCapTimer: no Source_Capabilities */
+    pdb_stats_timer_sink_wait_cap = 0,
+    /* SenderResponseTimer: no response to a message we sent */
+    pdb_stats_timer_sender_response = 1,
+    /* PSTransitionTimer: no PS_RDY */
+    pdb_stats_timer_ps_transition = 2,
+    /* ChunkSenderResponseTimer: no chunk after a Chunk Request */
+    pdb_stats_timer_chunk_sender_response = 3,
+    /* SinkEPREnterTimer: EPR Mode entry didn't finish */
+    pdb_stats_timer_sink_epr_enter = 4,
+    /* HardResetCompleteTimer: the PHY didn't confirm sending Hard Reset */
+    pdb_stats_timer_hard_reset_complete = 5,
+    /* The protocol layer didn't send the Hard Reset the Policy Engine asked
+     * for */
+    pdb_stats_timer_hard_reset_sent = 6,
+    /* The Policy Engine didn't finish a hard reset in time */
+    pdb_stats_timer_hard_reset_pe = 7
+};
+
+#define PDB_STATS_NUM_TIMERS 8
+
+/*
+ * Statistics about a port's PD link
+ *
+ * All counters start at zero in pdb_init and are only changed by pdb_poll, so
+ * copying the whole structure between calls to pdb_poll takes a consistent
+ * snapshot without any locking.  Counters wrap around when they overflow.
+ */
+struct pdb_stats {
+    /* Messages passed to the Policy Engine, by class and type */
+    uint16_t rx[PDB_MSG_NUM_CLASSES][PDB_MSG_NUM_TYPES];
+    /* Messages sent and acknowledged with GoodCRC, by class and type */
+    uint16_t tx[PDB_MSG_NUM_CLASSES][PDB_MSG_NUM_TYPES];
+
+    /* Received messages dropped for repeating the last MessageID */
+    uint32_t rx_duplicates;
+    /* Received messages dropped because they couldn't be read or were
+     * malformed */
+    uint32_t rx_dropped;
+    /* Received messages dropped because the Policy Engine's mailbox was
+     * full */
+    uint32_t rx_mailbox_overflows;
+    /* Messages the PHY gave up on after all its retries (I_RETRYFAIL) */
+    uint32_t tx_retry_fails;
+    /* Messages answered with something other than the GoodCRC we expected */
+    uint32_t tx_goodcrc_mismatches;
+    /* Messages discarded because a message was received while sending */
+    uint32_t tx_discarded;
+
+    /* Soft_Reset messages sent and received */
+    uint32_t soft_resets_sent;
+    uint32_t soft_resets_received;
+    /* Hard Reset signaling sent and received */
+    uint32_t hard_resets_sent;
+    uint32_t hard_resets_received;
+
+    /* Expiry counts of each enum pdb_stats_timer */
+    uint32_t timeouts[PDB_STATS_NUM_TIMERS];
+
+    /* Explicit contracts made */
+    uint32_t contracts;
+    /* Explicit contracts made to replace another one */
+    uint32_t renegotiations;
+    /* Power change AMSs saved by merging them into another */
+    uint32_t coalesced_requests;
+    /* Harmless messages ignored while waiting for Source_Capabilities or
+     * PS_RDY */
+    uint32_t recovery_ignored;
+    /* Soft resets sent to recover from unexpected messages */
+    uint32_t recovery_soft_resets;
+    /* Hard resets sent to recover from unexpected messages or a missing
+     * PS_RDY */
+    uint32_t recovery_hard_resets;
+    /* The time from the start of the last hard reset to the next explicit
+     * contract, and the longest such time, in milliseconds */
+    uint32_t hard_reset_recovery_time;
+    uint32_t hard_reset_recovery_max;
+};
+
+/*
+ * Set all the statistics back to zero.
+ */
+void pdb_stats_reset(struct pdb_config *cfg);
+
+#endif /* PDB_STATS_H */
@@ -0,0 +1,102 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_TIMING_H
+#define PDB_TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* Forward declaration of struct pdb_config */
+struct pdb_config;
+
+/*
+ * Timing requirements checked by the compliance monitor
+ */
+enum pdb_timing_check {
+    /* We answered a message that needs a response (Source_Capabilities,
+     * Get_Sink_Cap, Soft_Reset, ...) within tReceiverResponse */
+    pdb_timing_our_response = 0,
+    /* The source answered a message of ours that needs a response (Request,
+     * Get_Source_Cap, Soft_Reset, ...) within tReceiverResponse */
+    pdb_timing_source_response = 1,
+    /* The source sent PS_RDY within tPSTransition of accepting a Request */
+    pdb_timing_ps_transition = 2,
+    /* We repeated our Request within tPPSRequest during a PPS or AVS
+     * contract */
+    pdb_timing_pps_request = 3,
+    /* pdb_poll was called again within PDB_T_POLL_MAX.  Longer gaps delay
+     * every response and timeout, so they're the usual cause of the other
+     * violations. */
+    pdb_timing_poll_gap = 4,
+    /* We waited at least tSinkRequest after the source answered our Request
+     * with Wait before repeating it.  Unlike the others, this is violated by
+     * being too quick. */
+    pdb_timing_sink_request = 5
+};
+
+#define PDB_TIMING_NUM_CHECKS 6
+
+/*
+ * Measurements of one timing requirement
+ */
+struct pdb_timing_stats {
+    /* The number of measurements */
+    uint32_t count;
+    /* The last and longest measured times, in microseconds */
+    uint32_t last;
+    uint32_t max;
+    /* The number of measurements over the limit */
+    uint32_t violations;
+};
+
+/*
+ * Timing compliance monitor variables
+ */
+struct pdb_timing {
+    /* Measurements of each enum pdb_timing_check */
+    struct pdb_timing_stats checks[PDB_TIMING_NUM_CHECKS];
+
+    /* When we received a message we have yet to answer */
+    uint64_t _rx_time;
+    bool _rx_pending;
+    /* When we sent a message the source has yet to answer */
+    uint64_t _tx_time;
+    bool _tx_pending;
+    /* Whether or not the last message we sent was a Request */
+    bool _tx_request;
+    /* When the source answered our Request with Wait */
+    uint64_t _wait_time;
+    bool _wait_pending;
+    /* When the source accepted our Request */
+    uint64_t _accept_time;
+    bool _accept_pending;
+    /* When we last sent a Request with an explicit contract */
+    uint64_t _request_time;
+    bool _request_valid;
+    /* When pdb_poll was last called */
+    uint64_t _poll_time;
+    bool _poll_valid;
+};
+
+/*
+ * Get the total number of timing violations seen.
+ */
+uint32_t pdb_timing_violations(const struct pdb_config *cfg);
+
+#endif /* PDB_TIMING_H */
@@ -0,0 +1,87 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_VDM_H
+#define PDB_VDM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <pdb_msg.h>
+
+
+/* Forward declaration of struct pdb_config */
+struct pdb_config;
+
+/*
+ * What we say about ourselves in response to Discover Identity
+ */
+struct pdb_vdm_identity {
+    /* USB-IF Vendor ID */
+    uint16_t vid;
+    /* USB Product ID */
+    uint16_t pid;
+    /* Device release number, in BCD */
+    uint16_t bcd_device;
+    /* USB-IF Test ID, or 0 if we don't have one */
+    uint32_t xid;
+    /* Product Type (UFP), one of the PD_IDH_UFP_TYPE_* values */
+    uint32_t product_type;
+    /* Whether or not we're capable of USB communications as a device */
+    bool usb_device;
+};
+
+/*
+ * Handle a structured VDM request for an SVID.
+ *
+ * The second parameter is the request.  The third parameter is the response,
+ * whose VDM header already echoes the request except for its command type.
+ * The handler must choose ACK, NAK or BUSY as the command type, add any VDOs,
+ * and set the number of data objects in the message header.
+ *
+ * Returns true if a response was written, or false to answer with NAK.
+ */
+typedef bool (*pdb_vdm_handler_func)(struct pdb_config *, const union pd_msg *,
+        union pd_msg *);
+
+/*
+ * An entry in the table of SVID handlers
+ */
+struct pdb_vdm_svid_handler {
+    /* The SVID this handler is for */
+    uint16_t svid;
+    /* The handler */
+    pdb_vdm_handler_func handler;
+};
+
+/*
+ * Structure for the structured VDM responder configuration
+ *
+ * All fields are user-initialized.  Leaving the structure zeroed makes us NAK
+ * every structured VDM request, including Discover Identity.
+ */
+struct pdb_vdm_config {
+    /* Our identity, or NULL to NAK Discover Identity */
+    const struct pdb_vdm_identity *identity;
+    /* Handlers for SVIDs other than the PD SID, listed in response to
+     * Discover SVIDs */
+    const struct pdb_vdm_svid_handler *handlers;
+    /* The number of entries in handlers */
+    uint8_t num_handlers;
+};
+
+#endif /* PDB_VDM_H */
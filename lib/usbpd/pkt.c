@@ -0,0 +1,67 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pkt.h"
+
+#include <stddef.h>
+
+#include "pt-evt.h"
+
+
+void pdb_pkt_capture(struct pdb_config *cfg, enum pdb_pkt_dir dir,
+        const union pd_msg *msg)
+{
+    struct pdb_pkt_ring *ring = cfg->pkt_ring;
+    if (ring == NULL) {
+        return;
+    }
+    /* Indexing the buffer relies on its size being a power of two */
+    if (ring->size == 0 || (ring->size & (ring->size - 1))) {
+        return;
+    }
+
+    struct pdb_pkt *pkt = &ring->buf[ring->w & (ring->size - 1)];
+    pkt->time = micros();
+    pkt->dir = dir;
+    pkt->sop = pdb_pkt_sop;
+    pkt->hdr = msg->hdr;
+    for (int i = 0; i < 7; i++) {
+        pkt->obj[i] = msg->obj[i];
+    }
+
+    ring->w++;
+}
+
+bool pdb_pkt_read(const struct pdb_pkt_ring *ring, uint32_t *r,
+        struct pdb_pkt *pkt, uint32_t *lost)
+{
+    if (*r == ring->w) {
+        return false;
+    }
+
+    /* If the packets we haven't read were overwritten, skip them */
+    if (ring->w - *r > ring->size) {
+        if (lost != NULL) {
+            *lost += ring->w - *r - ring->size;
+        }
+        *r = ring->w - ring->size;
+    }
+
+    *pkt = ring->buf[*r & (ring->size - 1)];
+    (*r)++;
+    return true;
+}
@@ -23,11 +23,44 @@
 #include <pd.h>
 #include "protocol_tx.h"
 #include "hard_reset.h"
+#include "vdm.h"
 #include "fusb302b.h"
 
 #include "pt.h"
 #include "pt-evt.h"
 
+/*
+ * Number of times a Request is repeated after the source answers Wait before
+ * we have an explicit contract
+ */
+#define PDB_N_WAIT_RETRY 3
+
+/*
+ * Time the FUSB302B must stay cool before we step power back up by one
+ * derating level
+ */
+#define PDB_T_DERATE_COOLDOWN TIME_S2I(10)
+
+/*
+ * How long to wait for the protocol layer to send Hard Reset signaling.  It
+ * takes up to tHardResetComplete plus a few polls.
+ */
+#define PDB_T_HARD_SENT TIME_MS2I(50)
+
+/*
+ * Recovery from unexpected messages while waiting for Source_Capabilities or
+ * PS_RDY.  Harmless messages (Ping and Vendor_Defined) may be ignored, and up
+ * to PDB_N_RECOVERY_SOFT_RESET soft resets are tried between contracts
+ * before falling back to a hard reset.  Either may be defined at build time;
+ * setting both to 0 gives the old behaviour of always sending a hard reset.
+ */
+#ifndef PDB_RECOVERY_IGNORE_BENIGN
+#define PDB_RECOVERY_IGNORE_BENIGN 1
+#endif
+#ifndef PDB_N_RECOVERY_SOFT_RESET
+#define PDB_N_RECOVERY_SOFT_RESET 1
+#endif
+
 enum policy_engine_state {
     PESinkStartup,
     PESinkDiscovery,
@@ -45,7 +78,15 @@ enum policy_engine_state {
     PESinkSendNotSupported,
     PESinkChunkReceived,
     PESinkNotSupportedReceived,
-    PESinkSourceUnresponsive
+    PESinkSourceUnresponsive,
+    PESinkWaitRetry,
+    PESinkReceiveExtended,
+    PESinkGiveExtended,
+    PESinkSendExtended,
+    PESinkEPRModeEntry,
+    PESinkEPRKeepAlive,
+    PESinkGetStatus,
+    PESinkGiveVDM
 };
 
 static PT_THREAD(pe_sink_startup(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
@@ -79,105 +120,354 @@ static PT_THREAD(pe_sink_discovery(struct pt *pt, struct pdb_config *cfg, enum p
     PT_END(pt);
 }
 
+/*
+ * Check if a message is of the given class and type.  The types of control,
+ * data and extended messages overlap, so the type alone isn't enough.
+ */
+static bool pe_msg_is(const union pd_msg *msg, enum pdb_msg_class msg_class,
+        uint8_t type)
+{
+    return PDB_MSG_CLASS_GET(msg) == msg_class && PD_MSGTYPE_GET(msg) == type;
+}
+
+/*
+ * Get the time left before a timeout that started at start runs out
+ */
+static uint64_t pe_time_left(uint64_t start, uint64_t timeout)
+{
+    uint64_t elapsed = pt_time_since(start);
+
+    return (elapsed < timeout) ? timeout - elapsed : 0;
+}
+
+/*
+ * Check if a message is one we can safely ignore while waiting for something
+ * else: a Ping or a Vendor_Defined message.
+ */
+static bool pe_benign_message(const union pd_msg *msg)
+{
+    return pe_msg_is(msg, pdb_msg_control, PD_MSGTYPE_PING)
+        || pe_msg_is(msg, pdb_msg_data, PD_MSGTYPE_VENDOR_DEFINED);
+}
+
+/*
+ * Choose how to recover from an unexpected message: with a soft reset if we
+ * haven't used them all up since our last contract, otherwise with a hard
+ * reset.
+ */
+static enum policy_engine_state pe_sink_recover(struct pdb_config *cfg)
+{
+    if (cfg->pe._recovery_soft_resets < PDB_N_RECOVERY_SOFT_RESET) {
+        cfg->pe._recovery_soft_resets++;
+        cfg->stats.recovery_soft_resets++;
+        return PESinkSendSoftReset;
+    }
+    cfg->stats.recovery_hard_resets++;
+    return PESinkHardReset;
+}
+
+/*
+ * Raise the derating level after an overtemperature event or a source fault
+ */
+static void pe_sink_derate(struct pdb_config *cfg)
+{
+    if (cfg->dpm.derate != NULL && cfg->pe._derate_level < PDB_DERATE_MAX_LEVEL) {
+        cfg->pe._derate_level++;
+    }
+    cfg->pe._derate_last_time = micros();
+}
+
 static PT_THREAD(pe_sink_wait_cap(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
 {
     PT_BEGIN(pt);
-    /* Fetch a message from the protocol layer */
     static uint32_t evt;
-    PT_EVT_WAIT_TO(pt, &cfg->pe.events,
-            PDB_EVT_PE_MSG_RX | PDB_EVT_PE_I_OVRTEMP | PDB_EVT_PE_RESET, PD_T_TYPEC_SINK_WAIT_CAP, &evt);
+    /* When we started waiting, so ignored messages don't restart
+     * SinkWaitCapTimer */
+    static uint64_t start;
+    static uint64_t timeout;
 
-    /* If we timed out waiting for Source_Capabilities, send a hard reset */
-    if (evt == 0) {
-        *res = PESinkHardReset;
-        PT_EXIT(pt);
-    }
-    /* If we got reset signaling, transition to default */
-    if (evt & PDB_EVT_PE_RESET) {
-        *res = PESinkTransitionDefault;
-        PT_EXIT(pt);
-    }
-    /* If we're too hot, we shouldn't negotiate power yet */
-    if (evt & PDB_EVT_PE_I_OVRTEMP) {
-        *res = PESinkWaitCap;
-        PT_EXIT(pt);
-    }
+    start = micros();
+    while (true) {
+        /* Fetch a message from the protocol layer */
+        timeout = pe_time_left(start, PD_T_TYPEC_SINK_WAIT_CAP);
+        PT_EVT_WAIT_TO(pt, &cfg->pe.events,
+                PDB_EVT_PE_MSG_RX | PDB_EVT_PE_I_OVRTEMP | PDB_EVT_PE_RESET, timeout, &evt);
+
+        /* If we timed out waiting for Source_Capabilities, send a hard reset */
+        if (evt == 0) {
+            cfg->stats.timeouts[pdb_stats_timer_sink_wait_cap]++;
+            *res = PESinkHardReset;
+            PT_EXIT(pt);
+        }
+        /* If we got reset signaling, transition to default */
+        if (evt & PDB_EVT_PE_RESET) {
+            *res = PESinkTransitionDefault;
+            PT_EXIT(pt);
+        }
+        /* If we're too hot, we shouldn't negotiate power yet.  If we can
+         * derate, ask for less when we do. */
+        if (evt & PDB_EVT_PE_I_OVRTEMP) {
+            pe_sink_derate(cfg);
+            *res = PESinkWaitCap;
+            PT_EXIT(pt);
+        }
 
-    /* If we got a message */
-    if (evt & PDB_EVT_PE_MSG_RX) {
-        /* Get the message */
-        if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox))) {
-            /* If we got a Source_Capabilities message, read it. */
-            if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOURCE_CAPABILITIES
-                    && PD_NUMOBJ_GET(cfg->pe._message) > 0) {
-                /* First, determine what PD revision we're using */
-                if ((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_1_0) {
-                    /* If the other end is using at least version 3.0, we'll
-                     * use version 3.0. */
-                    if ((cfg->pe._message->hdr & PD_HDR_SPECREV) >= PD_SPECREV_3_0) {
-                        cfg->pe.hdr_template |= PD_SPECREV_3_0;
-                    /* Otherwise, use 2.0.  Don't worry about the 1.0 case
-                     * because we don't have hardware for PD 1.0 signaling. */
-                    } else {
-                        cfg->pe.hdr_template |= PD_SPECREV_2_0;
-                    }
-                }
-                *res = PESinkEvalCap;
-                PT_EXIT(pt);
-            /* If the message was a Soft_Reset, do the soft reset procedure */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOFT_RESET
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkSoftReset;
-                PT_EXIT(pt);
-            /* If we got an unexpected message, reset */
-            } else {
+        /* Get the message.  If we failed to get one, send a hard reset. */
+        if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox)) == NULL) {
+            *res = PESinkHardReset;
+            PT_EXIT(pt);
+        }
+
+        /* If we got a Source_Capabilities message, read it. */
+        if (pe_msg_is(cfg->pe._message, pdb_msg_data, PD_MSGTYPE_SOURCE_CAPABILITIES)) {
+            /* In EPR Mode, the source may only send EPR_Source_Capabilities,
+             * just as in the Ready state */
+            if (cfg->pe._epr_mode) {
                 cfg->pe._message = NULL;
                 *res = PESinkHardReset;
                 PT_EXIT(pt);
             }
+            /* First, determine what PD revision we're using */
+            if ((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_1_0) {
+                /* If the other end is using at least version 3.0, we'll
+                 * use version 3.0. */
+                if ((cfg->pe._message->hdr & PD_HDR_SPECREV) >= PD_SPECREV_3_0) {
+                    cfg->pe.hdr_template |= PD_SPECREV_3_0;
+                /* Otherwise, use 2.0.  Don't worry about the 1.0 case
+                 * because we don't have hardware for PD 1.0 signaling. */
+                } else {
+                    cfg->pe.hdr_template |= PD_SPECREV_2_0;
+                }
+            }
+            *res = PESinkEvalCap;
+            PT_EXIT(pt);
+        /* In EPR Mode, the source sends EPR_Source_Capabilities, which
+         * have to be received before they can be evaluated */
+        } else if (cfg->pe._epr_mode
+                && (cfg->pe._message->hdr & PD_HDR_EXT)
+                && PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_EPR_SOURCE_CAPABILITIES
+                && (cfg->pe._message->exthdr & PD_EXTHDR_CHUNKED)
+                && !(cfg->pe._message->exthdr & PD_EXTHDR_REQUEST_CHUNK)) {
+            /* Don't free the message: we need its first chunk */
+            *res = PESinkReceiveExtended;
+            PT_EXIT(pt);
+        /* If the message was a Soft_Reset, do the soft reset procedure */
+        } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_SOFT_RESET)) {
+            cfg->pe._message = NULL;
+            *res = PESinkSoftReset;
+            PT_EXIT(pt);
+        /* Keep waiting if the message is harmless */
+        } else if (PDB_RECOVERY_IGNORE_BENIGN && pe_benign_message(cfg->pe._message)) {
+            cfg->pe._message = NULL;
+            cfg->stats.recovery_ignored++;
+        /* If we got an unexpected message, reset */
+        } else {
+            cfg->pe._message = NULL;
+            *res = pe_sink_recover(cfg);
+            PT_EXIT(pt);
         }
     }
 
-    /* If we failed to get a message, send a hard reset */
-    *res = PESinkHardReset;
     PT_END(pt);
 }
 
-static PT_THREAD(pe_sink_eval_cap(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+/*
+ * Compute a fingerprint of the cached source capabilities
+ *
+ * This is a 32-bit FNV-1a hash of the number of data objects and the data
+ * objects themselves.  The header is left out since its MessageID changes
+ * every time the capabilities are sent.
+ */
+static uint32_t pe_caps_hash(struct pdb_config *cfg)
 {
-    PT_BEGIN(pt);
-    /* If we have a Source_Capabilities message, remember the index of the
-     * first PPS APDO so we can check if the request is for a PPS APDO in
-     * PE_SNK_Select_Cap. */
-    if (cfg->pe._message != NULL) {
-        /* Start by assuming we won't find a PPS APDO (set the index greater
-         * than the maximum possible) */
-        cfg->pe._pps_index = 8;
-        /* Search for the first PPS APDO */
-        for (int8_t i = 0; i < PD_NUMOBJ_GET(cfg->pe._message); i++) {
-            if ((cfg->pe._message->obj[i] & PD_PDO_TYPE) == PD_PDO_TYPE_AUGMENTED
-                    && (cfg->pe._message->obj[i] & PD_APDO_TYPE) == PD_APDO_TYPE_PPS) {
-                cfg->pe._pps_index = i + 1;
-                break;
-            }
+    uint32_t hash = 2166136261u;
+
+    hash = (hash ^ cfg->pe._caps_numobj) * 16777619u;
+    for (uint8_t i = 0; i < cfg->pe._caps_numobj; i++) {
+        for (uint8_t j = 0; j < 32; j += 8) {
+            hash = (hash ^ ((cfg->pe._caps[i] >> j) & 0xFF)) * 16777619u;
         }
-        /* New capabilities also means we can't be making a request from the
-         * same PPS APDO */
-        cfg->pe._last_pps = 8;
     }
 
+    return hash;
+}
+
+/*
+ * Find the PDO a Request is for in the cached capabilities.
+ *
+ * Returns true and sets *pdo if the object position is valid.
+ */
+static bool pe_request_pdo(struct pdb_config *cfg, const union pd_msg *req, uint32_t *pdo)
+{
+    uint8_t pos = PD_RDO_OBJPOS_GET(req);
+
+    if (pos == 0 || pos > cfg->pe._caps_numobj) {
+        return false;
+    }
+    *pdo = cfg->pe._caps[pos - 1];
+    return true;
+}
+
+/*
+ * Remember the PDO of the current Request if it's a PPS APDO, so that
+ * PE_SNK_Select_Cap can tell whether or not we stay on the same APDO.
+ */
+static void pe_sink_save_last_pps(struct pdb_config *cfg)
+{
+    uint32_t pdo;
+
     /* Remember the last PDO we requested if it was a PPS APDO */
-    if (PD_RDO_OBJPOS_GET(&cfg->pe._last_dpm_request) >= cfg->pe._pps_index) {
+    if (pe_request_pdo(cfg, &cfg->pe._last_dpm_request, &pdo) && PD_APDO_IS_PPS(pdo)) {
         cfg->pe._last_pps = PD_RDO_OBJPOS_GET(&cfg->pe._last_dpm_request);
     /* Otherwise, forget any PPS APDO we had requested */
     } else {
-        cfg->pe._last_pps = 8;
+        cfg->pe._last_pps = 0;
+    }
+}
+
+/*
+ * Take note of the capabilities just copied into _caps
+ */
+static void pe_sink_new_caps(struct pdb_config *cfg)
+{
+    /* Remember the index of the first PPS APDO for the PPS controller */
+    cfg->pe._pps_index = 0;
+    for (uint8_t i = 0; i < cfg->pe._caps_numobj; i++) {
+        if (PD_APDO_IS_PPS(cfg->pe._caps[i])) {
+            cfg->pe._pps_index = i + 1;
+            break;
+        }
+    }
+
+    /* If the capabilities changed, the position of the PPS APDO we were on
+     * may hold something else now */
+    uint32_t hash = pe_caps_hash(cfg);
+    if (hash != cfg->pe._caps_hash) {
+        cfg->pe._last_pps = 0;
+    }
+    cfg->pe._caps_hash = hash;
+}
+
+/*
+ * Find the voltage a Request asks for, using the cached capabilities.
+ *
+ * Returns the voltage in millivolts, or 0 if it isn't known.
+ */
+static uint16_t pe_request_voltage(struct pdb_config *cfg, const union pd_msg *req)
+{
+    uint32_t pdo;
+
+    if (!pe_request_pdo(cfg, req, &pdo)) {
+        return 0;
     }
 
-    /* Ask the DPM what to request */
-    cfg->dpm.evaluate_capability(cfg, cfg->pe._message,
-            &cfg->pe._last_dpm_request);
+    /* Fixed Supply PDOs have just one voltage */
+    if ((pdo & PD_PDO_TYPE) == PD_PDO_TYPE_FIXED) {
+        return PD_PDV2MV(PD_PDO_SRC_FIXED_VOLTAGE_GET(pdo));
+    }
+    /* Variable and Battery Supply PDOs may be anywhere in their range, so we
+     * only know their voltage if the range is a single voltage.  Both types
+     * keep their voltages in the same place. */
+    if ((pdo & PD_PDO_TYPE) == PD_PDO_TYPE_VARIABLE
+            || (pdo & PD_PDO_TYPE) == PD_PDO_TYPE_BATTERY) {
+        if (PD_PDO_SRC_VARIABLE_MIN_VOLTAGE_GET(pdo) == PD_PDO_SRC_VARIABLE_MAX_VOLTAGE_GET(pdo)) {
+            return PD_PDV2MV(PD_PDO_SRC_VARIABLE_MAX_VOLTAGE_GET(pdo));
+        }
+        return 0;
+    }
+    /* For PPS and AVS APDOs, the voltage is in the Request */
+    if (PD_APDO_IS_PPS(pdo)) {
+        return PD_PRV2MV((req->obj[0] & PD_RDO_PROG_VOLTAGE) >> PD_RDO_PROG_VOLTAGE_SHIFT);
+    }
+    if (PD_APDO_IS_AVS(pdo)) {
+        return PD_ARV2MV(PD_RDO_AVS_VOLTAGE_GET(req));
+    }
+
+    return 0;
+}
+
+/*
+ * Finish the Request we're about to send.
+ *
+ * In EPR Mode every Request is an EPR_Request, which carries a copy of the
+ * PDO it's for after the RDO.
+ */
+static void pe_sink_finish_request(struct pdb_config *cfg)
+{
+    union pd_msg *req = &cfg->pe._last_dpm_request;
+    uint32_t pdo;
+
+    if (cfg->pe._epr_mode && pe_request_pdo(cfg, req, &pdo)) {
+        req->hdr = cfg->pe.hdr_template | PD_MSGTYPE_EPR_REQUEST | PD_NUMOBJ(2);
+        req->obj[1] = pdo;
+    }
+
+    /* Let the source know we can enter EPR Mode */
+    if (cfg->dpm.epr_sink_pdp != NULL) {
+        req->obj[0] |= PD_RDO_EPR_CAPABLE;
+    }
+}
+
+static PT_THREAD(pe_sink_eval_cap(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    /* Whether or not we can send the cached Request instead of asking the
+     * DPM for a new one */
+    bool reuse = false;
+
+    /* Find out if our last Request was for a PPS APDO while we still have the
+     * capabilities it was made from */
+    pe_sink_save_last_pps(cfg);
+
+    /* A PPS controller Request still waiting for Ready was made from the old
+     * capabilities, so drop it.  The controller makes a new one once we have
+     * a contract again. */
+    cfg->pe.events &= ~PDB_EVT_PE_PPS_UPDATE;
+
+    /* If we have a Source_Capabilities message, keep a copy of the
+     * capabilities for later Requests that don't come from the DPM */
+    if (cfg->pe._message != NULL) {
+        cfg->pe._caps_numobj = PD_NUMOBJ_GET(cfg->pe._message);
+        for (uint8_t i = 0; i < cfg->pe._caps_numobj; i++) {
+            cfg->pe._caps[i] = cfg->pe._message->obj[i];
+        }
+        pe_sink_new_caps(cfg);
+
+        /* If these are the capabilities our last explicit contract was made
+         * from, send the same Request again if the DPM allows it.  While
+         * we're derated, the DPM has to make a full power Request for us to
+         * derate instead. */
+        reuse = cfg->reuse_request && cfg->pe._caps_cache_valid
+            && cfg->pe._derate_level == 0
+            && cfg->pe._caps_hash == cfg->pe._cached_caps_hash;
+    /* EPR_Source_Capabilities were already copied into _caps */
+    } else if (cfg->pe._epr_caps_new) {
+        cfg->pe._epr_caps_new = false;
+        pe_sink_new_caps(cfg);
+    }
+
+    if (reuse) {
+        /* Send the cached Request.  It becomes valid again only once the
+         * source accepts it, so a source that refuses it makes us ask the
+         * DPM next time. */
+        cfg->pe._last_dpm_request = cfg->pe._cached_request;
+        cfg->pe._caps_cache_valid = false;
+    } else if (cfg->pe._epr_mode) {
+        /* Ask the DPM what to request from the EPR capabilities */
+        cfg->dpm.evaluate_epr_capability(cfg, cfg->pe._caps,
+                cfg->pe._caps_numobj, &cfg->pe._last_dpm_request);
+    } else {
+        /* Ask the DPM what to request */
+        cfg->dpm.evaluate_capability(cfg, cfg->pe._message,
+                &cfg->pe._last_dpm_request);
+    }
+    /* If we're too hot for full power, ask for less */
+    if (cfg->pe._derate_level > 0 && cfg->dpm.derate != NULL) {
+        cfg->dpm.derate(cfg, cfg->pe._derate_level, &cfg->pe._last_dpm_request);
+    }
+    /* This is a new Request, so start over with fallbacks and retries */
+    cfg->pe._fallback_rank = 0;
+    cfg->pe._wait_retries = 0;
     /* It's up to the DPM to free the Source_Capabilities message, which it can
      * do whenever it sees fit.  Just remove our reference to it since we won't
      * know when it's no longer valid. */
@@ -190,6 +480,7 @@ static PT_THREAD(pe_sink_eval_cap(struct pt *pt, struct pdb_config *cfg, enum po
 static PT_THREAD(pe_sink_select_cap(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
 {
     PT_BEGIN(pt);
+    pe_sink_finish_request(cfg);
     /* Transmit the request */
     pt_queue_push(&cfg->prl.tx_mailbox, cfg->pe._last_dpm_request);
     cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
@@ -207,16 +498,29 @@ static PT_THREAD(pe_sink_select_cap(struct pt *pt, struct pdb_config *cfg, enum
         PT_EXIT(pt);
     }
 
+    /* The Request we just sent refreshes our contract, so a pending
+     * SinkPPSPeriodicTimer expiry is redundant */
+    if (PT_EVT_GETANDCLEAR(&cfg->pe.events, PDB_EVT_PE_PPS_REQUEST)) {
+        cfg->stats.coalesced_requests++;
+    }
+
     /* If we're using PD 3.0 */
     if ((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_3_0) {
-        /* If the request was for a PPS APDO, start SinkPPSPeriodicTimer */
-        if (PD_RDO_OBJPOS_GET(&cfg->pe._last_dpm_request) >= cfg->pe._pps_index) {
-            cfg->pe._sink_pps_timer_enabled = true;
-            cfg->pe._sink_pps_last_time = millis();
+        /* If the request was for an adjustable supply, start
+         * SinkPPSPeriodicTimer.  AVS sources don't require it, but a
+         * periodic Request keeps them from falling back to vSafe5V should
+         * they lose track of us. */
+        uint32_t pdo;
+        if (pe_request_pdo(cfg, &cfg->pe._last_dpm_request, &pdo)
+                && PD_PDO_IS_APDO(pdo)) {
+            cfg->pe._sink_apdo_timer_enabled = true;
+            cfg->pe._sink_apdo_last_time = micros();
         /* Otherwise, stop SinkPPSPeriodicTimer */
         } else {
-            cfg->pe._sink_pps_timer_enabled = false;
+            cfg->pe._sink_apdo_timer_enabled = false;
         }
+        /* Any message we send restarts SinkEPRKeepAliveTimer */
+        cfg->pe._sink_epr_last_time = micros();
     }
     /* This will use a virtual timer to send an event flag to this thread after
      * PD_T_PPS_REQUEST */
@@ -230,6 +534,7 @@ static PT_THREAD(pe_sink_select_cap(struct pt *pt, struct pdb_config *cfg, enum
     }
     /* If we didn't get a response before the timeout, send a hard reset */
     if (evt == 0) {
+        cfg->stats.timeouts[pdb_stats_timer_sender_response]++;
         *res = PESinkHardReset;
         PT_EXIT(pt);
     }
@@ -237,10 +542,30 @@ static PT_THREAD(pe_sink_select_cap(struct pt *pt, struct pdb_config *cfg, enum
     /* Get the response message */
     if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox))) {
         /* If the source accepted our request, wait for the new power */
-        if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_ACCEPT
-                && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-            /* Transition to Sink Standby if necessary */
-            if (PD_RDO_OBJPOS_GET(&cfg->pe._last_dpm_request) != cfg->pe._last_pps) {
+        if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_ACCEPT)) {
+            /* Work out what kind of transition this is */
+            enum pdb_transition_type type = pdb_transition_voltage;
+            uint16_t mv = pe_request_voltage(cfg, &cfg->pe._last_dpm_request);
+            uint32_t pdo = 0;
+            pe_request_pdo(cfg, &cfg->pe._last_dpm_request, &pdo);
+            if (PD_APDO_IS_PPS(pdo)
+                    && PD_RDO_OBJPOS_GET(&cfg->pe._last_dpm_request) == cfg->pe._last_pps) {
+                type = pdb_transition_pps;
+            } else if (mv != 0 && mv == cfg->pe._contract_mv) {
+                type = pdb_transition_current;
+            /* Staying within the range of a Variable or Battery Supply we
+             * already have doesn't move Vbus any more than before */
+            } else if (pdo != 0 && pdo == cfg->pe._contract_pdo
+                    && ((pdo & PD_PDO_TYPE) == PD_PDO_TYPE_VARIABLE
+                        || (pdo & PD_PDO_TYPE) == PD_PDO_TYPE_BATTERY)) {
+                type = pdb_transition_current;
+            }
+            if (cfg->dpm.transition_type != NULL) {
+                cfg->dpm.transition_type(cfg, type);
+            }
+
+            /* Transition to Sink Standby if Vbus is going to move */
+            if (type == pdb_transition_voltage) {
                 cfg->dpm.transition_standby(cfg);
             }
 
@@ -250,17 +575,41 @@ static PT_THREAD(pe_sink_select_cap(struct pt *pt, struct pdb_config *cfg, enum
             *res = PESinkTransitionSink;
             PT_EXIT(pt);
         /* If the message was a Soft_Reset, do the soft reset procedure */
-        } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOFT_RESET
-                && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
+        } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_SOFT_RESET)) {
             cfg->pe._message = NULL;
             *res = PESinkSoftReset;
             PT_EXIT(pt);
         /* If the message was Wait or Reject */
-        } else if ((PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_REJECT
-                    || PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_WAIT)
-                && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-            /* If we don't have an explicit contract, wait for capabilities */
+        } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_REJECT)
+                || pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_WAIT)) {
+            /* If we don't have an explicit contract, try to get one without
+             * waiting for the next capabilities */
             if (!cfg->pe._explicit_contract) {
+                /* If the source wants us to wait, repeat the Request after
+                 * SinkRequestTimer */
+                if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_WAIT
+                        && cfg->pe._wait_retries < PDB_N_WAIT_RETRY) {
+                    cfg->pe._wait_retries++;
+                    cfg->pe._message = NULL;
+                    *res = PESinkWaitRetry;
+                    PT_EXIT(pt);
+                }
+                /* If the source rejected the Request, try the DPM's next
+                 * choice */
+                if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_REJECT
+                        && cfg->dpm.fallback_request != NULL
+                        && cfg->dpm.fallback_request(cfg,
+                            cfg->pe._fallback_rank + 1,
+                            &cfg->pe._last_dpm_request)) {
+                    cfg->pe._fallback_rank++;
+                    cfg->pe._wait_retries = 0;
+                    /* Tell the protocol layer we're starting an AMS */
+                    cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
+                    cfg->pe._message = NULL;
+                    *res = PESinkSelectCap;
+                    PT_EXIT(pt);
+                }
+                /* Otherwise, wait for capabilities */
                 cfg->pe._message = NULL;
                 *res = PESinkWaitCap;
                 PT_EXIT(pt);
@@ -286,103 +635,454 @@ static PT_THREAD(pe_sink_select_cap(struct pt *pt, struct pdb_config *cfg, enum
 static PT_THREAD(pe_sink_transition_sink(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
 {
     PT_BEGIN(pt);
-    /* Wait for the PS_RDY message */
     static uint32_t evt;
-    PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET, PD_T_PS_TRANSITION, &evt);
-    /* If we got reset signaling, transition to default */
-    if (evt & PDB_EVT_PE_RESET) {
-        *res = PESinkTransitionDefault;
-    }
-    /* If no message was received, send a hard reset */
-    if (evt == 0) {
-        PT_EXIT(pt);
+    /* When we started waiting, so ignored messages don't restart
+     * PSTransitionTimer */
+    static uint64_t start;
+    static uint64_t timeout;
+
+    start = micros();
+    while (true) {
+        /* Wait for the PS_RDY message */
+        timeout = pe_time_left(start, PD_T_PS_TRANSITION);
+        PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET, timeout, &evt);
+        /* If we got reset signaling, transition to default */
+        if (evt & PDB_EVT_PE_RESET) {
+            *res = PESinkTransitionDefault;
+            PT_EXIT(pt);
+        }
+        /* If no message was received, send a hard reset */
+        if (evt == 0) {
+            cfg->stats.timeouts[pdb_stats_timer_ps_transition]++;
+            cfg->stats.recovery_hard_resets++;
+            *res = PESinkHardReset;
+            PT_EXIT(pt);
+        }
+
+        /* Read the message.  Keep waiting if it's harmless, or if there
+         * wasn't one after all. */
+        cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox);
+        if (cfg->pe._message == NULL) {
+            continue;
+        }
+        if (PDB_RECOVERY_IGNORE_BENIGN && pe_benign_message(cfg->pe._message)) {
+            cfg->pe._message = NULL;
+            cfg->stats.recovery_ignored++;
+            continue;
+        }
+        break;
     }
 
-    /* If we received a message, read it */
-    if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox))) {
-        /* If we got a PS_RDY, handle it */
-        if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_PS_RDY
-                && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-            /* We just finished negotiating an explicit contract */
-            cfg->pe._explicit_contract = true;
-
-            /* Set the output appropriately */
-            if (!cfg->pe._min_power) {
-                cfg->dpm.transition_requested(cfg);
+    /* If we got a PS_RDY, handle it */
+    if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_PS_RDY)) {
+        /* We just finished negotiating an explicit contract */
+        cfg->stats.contracts++;
+        if (cfg->pe._explicit_contract) {
+            cfg->stats.renegotiations++;
+        }
+        cfg->pe._explicit_contract = true;
+        /* Unexpected messages may be met with soft resets again */
+        cfg->pe._recovery_soft_resets = 0;
+        /* If this contract ends a hard reset, note how long it took */
+        if (cfg->pe._hard_reset_recovering) {
+            cfg->pe._hard_reset_recovering = false;
+            cfg->stats.hard_reset_recovery_time = TIME_I2MS(pt_time_since(cfg->pe._hard_reset_start));
+            if (cfg->stats.hard_reset_recovery_time > cfg->stats.hard_reset_recovery_max) {
+                cfg->stats.hard_reset_recovery_max = cfg->stats.hard_reset_recovery_time;
             }
+        }
 
-            cfg->pe._message = NULL;
-            *res = PESinkReady;
-            PT_EXIT(pt);
-        /* If there was a protocol error, send a hard reset */
-        } else {
-            /* Turn off the power output before this hard reset to make sure we
-             * don't supply an incorrect voltage to the device we're powering.
-             */
-            cfg->dpm.transition_default(cfg);
+        /* Remember the voltage we'll have from now on */
+        cfg->pe._contract_mv = pe_request_voltage(cfg, &cfg->pe._last_dpm_request);
+        cfg->pe._contract_pdo = 0;
+        pe_request_pdo(cfg, &cfg->pe._last_dpm_request, &cfg->pe._contract_pdo);
+
+        /* Remember the accepted Request in case we see the same
+         * capabilities again, but only if it's for full power: a derated
+         * Request would be derated again, or kept after we've cooled down */
+        cfg->pe._cached_request = cfg->pe._last_dpm_request;
+        cfg->pe._cached_caps_hash = cfg->pe._caps_hash;
+        cfg->pe._caps_cache_valid = cfg->pe._derate_level == 0;
+
+        /* If both we and the source can use EPR, try to enter EPR Mode
+         * once we're in the Ready state */
+        if (!cfg->pe._epr_mode && !cfg->pe._epr_entry_failed
+                && (cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_3_0
+                && (cfg->pe._caps[0] & PD_PDO_SRC_FIXED_EPR_CAPABLE)
+                && cfg->dpm.epr_sink_pdp != NULL
+                && cfg->dpm.epr_sink_pdp(cfg) != 0) {
+            cfg->pe.events |= PDB_EVT_PE_EPR_ENTER;
+        }
 
-            cfg->pe._message = NULL;
-            *res = PESinkHardReset;
-            PT_EXIT(pt);
+        /* Set the output appropriately */
+        if (!cfg->pe._min_power) {
+            cfg->dpm.transition_requested(cfg);
         }
+
+        cfg->pe._message = NULL;
+        *res = PESinkReady;
+        PT_EXIT(pt);
     }
 
+    /* If there was a protocol error, send a hard reset.  Vbus may be moving,
+     * so a soft reset isn't enough here. */
+    /* Turn off the power output before this hard reset to make sure we don't
+     * supply an incorrect voltage to the device we're powering. */
+    cfg->dpm.transition_default(cfg);
+
+    cfg->pe._message = NULL;
+    cfg->stats.recovery_hard_resets++;
     *res = PESinkHardReset;
     PT_END(pt);
 }
 
-static PT_THREAD(pe_sink_ready(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+/*
+ * Drop the pending power change events in mask, because a Request we're about
+ * to send makes them redundant.  Each one dropped is an AMS saved.
+ */
+static void pe_sink_coalesce(struct pdb_config *cfg, uint32_t *evt, uint32_t mask)
 {
-    PT_BEGIN(pt);
-    static uint32_t evt;
+    uint32_t dropped = (*evt | PT_EVT_GETANDCLEAR(&cfg->pe.events, mask)) & mask;
 
-    /* Wait for an event */
-    if (cfg->pe._min_power) {
-        PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET
-                | PDB_EVT_PE_I_OVRTEMP | PDB_EVT_PE_GET_SOURCE_CAP
-                | PDB_EVT_PE_NEW_POWER | PDB_EVT_PE_PPS_REQUEST,
-                PD_T_SINK_REQUEST, &evt);
-    } else {
-        PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET
-                | PDB_EVT_PE_I_OVRTEMP | PDB_EVT_PE_GET_SOURCE_CAP
-                | PDB_EVT_PE_NEW_POWER | PDB_EVT_PE_PPS_REQUEST, &evt);
+    *evt &= ~mask;
+    while (dropped) {
+        cfg->stats.coalesced_requests++;
+        dropped &= dropped - 1;
     }
+}
 
-    /* If we got reset signaling, transition to default */
-    if (evt & PDB_EVT_PE_RESET) {
-        *res = PESinkTransitionDefault;
-        PT_EXIT(pt);
+/*
+ * What to do with each kind of message received in the Ready state
+ */
+enum pe_ready_action {
+    /* Not handled by the library: ask the user's handlers */
+    PE_RDY_UNKNOWN = 0,
+    PE_RDY_IGNORE,
+    PE_RDY_NOT_SUPPORTED,
+    PE_RDY_SOFT_RESET,
+    PE_RDY_GOTOMIN,
+    PE_RDY_SOURCE_CAP,
+    PE_RDY_GIVE_SINK_CAP,
+    PE_RDY_VDM,
+    PE_RDY_GIVE_SINK_CAP_EXT,
+    PE_RDY_EPR_MODE,
+    PE_RDY_ALERT,
+    PE_RDY_NOT_SUPPORTED_RX,
+    PE_RDY_EXTENDED
+};
+
+/* Flag for actions that only apply when we're using PD 3.0 */
+#define PE_RDY_PD30 0x80
+
+/*
+ * The action for each message class and type
+ */
+static const uint8_t pe_ready_actions[PDB_MSG_NUM_CLASSES][PDB_MSG_NUM_TYPES] = {
+    [pdb_msg_control] = {
+        [PD_MSGTYPE_GOTOMIN] = PE_RDY_GOTOMIN,
+        [PD_MSGTYPE_PING] = PE_RDY_IGNORE,
+        [PD_MSGTYPE_GET_SOURCE_CAP] = PE_RDY_NOT_SUPPORTED,
+        [PD_MSGTYPE_GET_SINK_CAP] = PE_RDY_GIVE_SINK_CAP,
+        [PD_MSGTYPE_DR_SWAP] = PE_RDY_NOT_SUPPORTED,
+        [PD_MSGTYPE_PR_SWAP] = PE_RDY_NOT_SUPPORTED,
+        [PD_MSGTYPE_VCONN_SWAP] = PE_RDY_NOT_SUPPORTED,
+        [PD_MSGTYPE_SOFT_RESET] = PE_RDY_SOFT_RESET,
+        [PD_MSGTYPE_NOT_SUPPORTED] = PE_RDY_NOT_SUPPORTED_RX | PE_RDY_PD30,
+        [PD_MSGTYPE_GET_SINK_CAP_EXTENDED] = PE_RDY_GIVE_SINK_CAP_EXT | PE_RDY_PD30
+    },
+    [pdb_msg_data] = {
+        [PD_MSGTYPE_SOURCE_CAPABILITIES] = PE_RDY_SOURCE_CAP,
+        [PD_MSGTYPE_REQUEST] = PE_RDY_NOT_SUPPORTED,
+        [PD_MSGTYPE_SINK_CAPABILITIES] = PE_RDY_NOT_SUPPORTED,
+        [PD_MSGTYPE_ALERT] = PE_RDY_ALERT | PE_RDY_PD30,
+        [PD_MSGTYPE_EPR_MODE] = PE_RDY_EPR_MODE | PE_RDY_PD30,
+        [PD_MSGTYPE_VENDOR_DEFINED] = PE_RDY_VDM
+    },
+    [pdb_msg_extended] = {
+        [PD_MSGTYPE_SOURCE_CAPABILITIES_EXTENDED] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_STATUS] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_GET_BATTERY_CAP] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_GET_BATTERY_STATUS] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_BATTERY_CAPABILITIES] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_GET_MANUFACTURER_INFO] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_MANUFACTURER_INFO] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_SECURITY_REQUEST] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_SECURITY_RESPONSE] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_FIRMWARE_UPDATE_REQUEST] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_FIRMWARE_UPDATE_RESPONSE] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_PPS_STATUS] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_COUNTRY_INFO] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_COUNTRY_CODES] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_SINK_CAPABILITIES_EXTENDED] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_EXTENDED_CONTROL] = PE_RDY_EXTENDED | PE_RDY_PD30,
+        [PD_MSGTYPE_EPR_SOURCE_CAPABILITIES] = PE_RDY_EXTENDED | PE_RDY_PD30
     }
+};
 
-    /* If we overheated, send a hard reset */
-    if (evt & PDB_EVT_PE_I_OVRTEMP) {
-        *res = PESinkHardReset;
-        PT_EXIT(pt);
+/*
+ * Start receiving the extended message received in the Ready state
+ */
+static enum policy_engine_state pe_sink_ready_extended(struct pdb_config *cfg)
+{
+    /* If the message is an unchunked extended message longer than one chunk,
+     * we can't receive it, so let it time out. */
+    if (!(cfg->pe._message->exthdr & PD_EXTHDR_CHUNKED)
+            && PD_DATA_SIZE_GET(cfg->pe._message) > PD_MAX_EXT_MSG_LEGACY_LEN) {
+        cfg->pe._message = NULL;
+        return PESinkChunkReceived;
     }
+    /* Ignore Chunk Requests, since we aren't sending anything */
+    if (cfg->pe._message->exthdr & PD_EXTHDR_REQUEST_CHUNK) {
+        cfg->pe._message = NULL;
+        return PESinkReady;
+    }
+    /* Otherwise, receive the whole message.  Don't free the message: we need
+     * its first chunk. */
+    return PESinkReceiveExtended;
+}
 
-    /* If the DPM wants us to, send a Get_Source_Cap message */
-    if (evt & PDB_EVT_PE_GET_SOURCE_CAP) {
-        /* Tell the protocol layer we're starting an AMS */
-        cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
-        *res = PESinkGetSourceCap;
-        PT_EXIT(pt);
+/*
+ * Handle the message received in the Ready state
+ *
+ * The message is classified with a single table lookup.  Returns the next
+ * state.  _message is cleared unless the next state needs it.
+ */
+static enum policy_engine_state pe_sink_ready_dispatch(struct pdb_config *cfg)
+{
+    const union pd_msg *msg = cfg->pe._message;
+    uint8_t type = PD_MSGTYPE_GET(msg);
+    enum pdb_msg_class msg_class = PDB_MSG_CLASS_GET(msg);
+    uint8_t action = pe_ready_actions[msg_class][type];
+
+    /* PD 3.0 messages are unknown if we aren't using PD 3.0 */
+    if ((action & PE_RDY_PD30)
+            && (cfg->pe.hdr_template & PD_HDR_SPECREV) != PD_SPECREV_3_0) {
+        action = PE_RDY_UNKNOWN;
     }
 
-    /* If the DPM wants new power, let it figure out what power it wants
-     * exactly.  This isn't exactly the transition from the spec (that would be
-     * SelectCap, not EvalCap), but this works better with the particular
-     * design of this firmware. */
-    if (evt & PDB_EVT_PE_NEW_POWER) {
-        /* Make sure we're evaluating NULL capabilities to use the old ones */
-        if (cfg->pe._message != NULL) {
+    switch (action & ~PE_RDY_PD30) {
+        case PE_RDY_IGNORE:
             cfg->pe._message = NULL;
-        }
-        /* Tell the protocol layer we're starting an AMS */
-        cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
+            return PESinkReady;
+        case PE_RDY_NOT_SUPPORTED:
+            cfg->pe._message = NULL;
+            return PESinkSendNotSupported;
+        /* If the message was a Soft_Reset, do the soft reset procedure */
+        case PE_RDY_SOFT_RESET:
+            cfg->pe._message = NULL;
+            return PESinkSoftReset;
+        /* Handle GotoMin messages */
+        case PE_RDY_GOTOMIN:
+            cfg->pe._message = NULL;
+            if (cfg->dpm.giveback_enabled != NULL
+                    && cfg->dpm.giveback_enabled(cfg)) {
+                /* Transition to the minimum current level */
+                cfg->dpm.transition_min(cfg);
+                cfg->pe._min_power = true;
+                return PESinkTransitionSink;
+            }
+            /* GiveBack is not supported */
+            return PESinkSendNotSupported;
+        /* Evaluate new Source_Capabilities */
+        case PE_RDY_SOURCE_CAP:
+            /* In EPR Mode, the source may only send EPR_Source_Capabilities */
+            if (cfg->pe._epr_mode) {
+                cfg->pe._message = NULL;
+                return PESinkHardReset;
+            }
+            /* Don't free the message: we need to keep the
+             * Source_Capabilities message so we can evaluate it. */
+            return PESinkEvalCap;
+        /* Give sink capabilities when asked */
+        case PE_RDY_GIVE_SINK_CAP:
+            cfg->pe._message = NULL;
+            return PESinkGiveSinkCap;
+        /* Answer structured VDM requests, and ignore any other vendor-defined
+         * messages */
+        case PE_RDY_VDM: {
+            bool respond = pdb_vdm_respond(cfg, msg, &cfg->pe._vdm_response);
+            cfg->pe._message = NULL;
+            return respond ? PESinkGiveVDM : PESinkReady;
+        }
+        /* Give extended sink capabilities when asked */
+        case PE_RDY_GIVE_SINK_CAP_EXT:
+            cfg->pe._ext_msg.hdr = msg->hdr;
+            cfg->pe._ext_msg.size = 0;
+            cfg->pe._message = NULL;
+            return PESinkGiveExtended;
+        /* Leave EPR Mode when the source tells us to, and wait for its SPR
+         * capabilities */
+        case PE_RDY_EPR_MODE:
+            cfg->pe._message = NULL;
+            if (PD_NUMOBJ_GET(msg) == 1
+                    && PD_EPRMDO_ACTION_GET(msg) == PD_EPRMDO_ACTION_EXIT
+                    && cfg->pe._epr_mode) {
+                cfg->pe._epr_mode = false;
+                return PESinkWaitCap;
+            }
+            return PESinkSendSoftReset;
+        /* Handle Alerts from the source */
+        case PE_RDY_ALERT: {
+            cfg->pe._message = NULL;
+            if (PD_NUMOBJ_GET(msg) != 1) {
+                return PESinkSendSoftReset;
+            }
+            uint32_t ado = msg->obj[0];
+            /* Let the DPM shed load right away */
+            if (cfg->dpm.alert_received != NULL) {
+                cfg->dpm.alert_received(cfg, ado);
+            }
+            /* If the source had a fault, ask for less power before anything
+             * else */
+            if ((PD_ADO_TYPE_GET(ado) & PD_ADO_TYPE_FAULT) && cfg->dpm.derate != NULL) {
+                pe_sink_derate(cfg);
+                cfg->pe.events |= PDB_EVT_PE_NEW_POWER;
+            }
+            /* Find out more with Get_Status, unless the alert is only about
+             * batteries */
+            if (PD_ADO_TYPE_GET(ado) & ~PD_ADO_TYPE_BATTERY_STATUS) {
+                cfg->pe.events |= PDB_EVT_PE_GET_STATUS;
+            }
+            return PESinkReady;
+        }
+        /* Tell the DPM a message we sent got a response of Not_Supported. */
+        case PE_RDY_NOT_SUPPORTED_RX:
+            cfg->pe._message = NULL;
+            return PESinkNotSupportedReceived;
+        case PE_RDY_EXTENDED:
+            return pe_sink_ready_extended(cfg);
+        default:
+            break;
+    }
+
+    /* If the user has a handler for the message, let it have a go */
+    for (uint8_t i = 0; i < cfg->num_msg_handlers; i++) {
+        const struct pdb_msg_handler *h = &cfg->msg_handlers[i];
+        if (h->msg_class == msg_class && h->type == type) {
+            if (h->handler(cfg, msg)) {
+                cfg->pe._message = NULL;
+                return PESinkReady;
+            }
+            break;
+        }
+    }
+
+    /* In PD 3.0, receive any other extended message so the DPM can answer
+     * it */
+    if (msg_class == pdb_msg_extended
+            && (cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_3_0) {
+        return pe_sink_ready_extended(cfg);
+    }
+
+    /* If we got an unknown message, send a soft reset */
+    cfg->pe._message = NULL;
+    return PESinkSendSoftReset;
+}
+
+static PT_THREAD(pe_sink_ready(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    static uint32_t evt;
+
+    /* Wait for an event */
+    if (cfg->pe._min_power) {
+        PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET
+                | PDB_EVT_PE_I_OVRTEMP | PDB_EVT_PE_GET_SOURCE_CAP
+                | PDB_EVT_PE_NEW_POWER | PDB_EVT_PE_PPS_REQUEST
+                | PDB_EVT_PE_PPS_UPDATE | PDB_EVT_PE_EPR_ENTER
+                | PDB_EVT_PE_EPR_KEEPALIVE | PDB_EVT_PE_COOLED
+                | PDB_EVT_PE_GET_STATUS, PD_T_SINK_REQUEST, &evt);
+    } else {
+        PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET
+                | PDB_EVT_PE_I_OVRTEMP | PDB_EVT_PE_GET_SOURCE_CAP
+                | PDB_EVT_PE_NEW_POWER | PDB_EVT_PE_PPS_REQUEST
+                | PDB_EVT_PE_PPS_UPDATE | PDB_EVT_PE_EPR_ENTER
+                | PDB_EVT_PE_EPR_KEEPALIVE | PDB_EVT_PE_COOLED
+                | PDB_EVT_PE_GET_STATUS, &evt);
+    }
+
+    /* If we got reset signaling, transition to default */
+    if (evt & PDB_EVT_PE_RESET) {
+        *res = PESinkTransitionDefault;
+        PT_EXIT(pt);
+    }
+
+    /* If we overheated, renegotiate for less power.  If the DPM can't
+     * derate, send a hard reset. */
+    if (evt & PDB_EVT_PE_I_OVRTEMP) {
+        if (cfg->dpm.derate == NULL) {
+            *res = PESinkHardReset;
+            PT_EXIT(pt);
+        }
+        pe_sink_derate(cfg);
+        evt |= PDB_EVT_PE_NEW_POWER;
+    }
+
+    /* If we've cooled down, step power back up */
+    if (evt & PDB_EVT_PE_COOLED) {
+        if (cfg->pe._derate_level > 0) {
+            cfg->pe._derate_level--;
+        }
+        evt |= PDB_EVT_PE_NEW_POWER;
+    }
+
+    /* Only the newest power change matters.  A Request from the DPM
+     * supersedes one from the PPS controller, and either one refreshes a PPS
+     * contract, so merge them before starting an AMS. */
+    if (evt & PDB_EVT_PE_NEW_POWER) {
+        pe_sink_coalesce(cfg, &evt, PDB_EVT_PE_PPS_UPDATE | PDB_EVT_PE_PPS_REQUEST);
+    } else if (evt & PDB_EVT_PE_PPS_UPDATE) {
+        pe_sink_coalesce(cfg, &evt, PDB_EVT_PE_PPS_REQUEST);
+    }
+
+    /* Keeping EPR Mode alive, entering it, and asking about a source's status
+     * all wait until any power change is done */
+    if (evt & (PDB_EVT_PE_GET_SOURCE_CAP | PDB_EVT_PE_NEW_POWER
+                | PDB_EVT_PE_PPS_UPDATE | PDB_EVT_PE_PPS_REQUEST)) {
+        cfg->pe.events |= evt & (PDB_EVT_PE_EPR_ENTER | PDB_EVT_PE_EPR_KEEPALIVE
+                | PDB_EVT_PE_GET_STATUS);
+    }
+
+    /* If the DPM wants us to, send a Get_Source_Cap message */
+    if (evt & PDB_EVT_PE_GET_SOURCE_CAP) {
+        /* Handle any power change when we get back */
+        cfg->pe.events |= evt & (PDB_EVT_PE_NEW_POWER | PDB_EVT_PE_PPS_UPDATE
+                | PDB_EVT_PE_PPS_REQUEST);
+        /* Tell the protocol layer we're starting an AMS */
+        cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
+        *res = PESinkGetSourceCap;
+        PT_EXIT(pt);
+    }
+
+    /* If the DPM wants new power, let it figure out what power it wants
+     * exactly.  This isn't exactly the transition from the spec (that would be
+     * SelectCap, not EvalCap), but this works better with the particular
+     * design of this firmware. */
+    if (evt & PDB_EVT_PE_NEW_POWER) {
+        /* Make sure we're evaluating NULL capabilities to use the old ones */
+        if (cfg->pe._message != NULL) {
+            cfg->pe._message = NULL;
+        }
+        /* Tell the protocol layer we're starting an AMS */
+        cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
         *res = PESinkEvalCap;
         PT_EXIT(pt);
     }
 
+    /* If the PPS controller wants a new setpoint, request it directly.
+     * There's no need to bother the DPM since the controller already knows
+     * exactly what it wants. */
+    if (evt & PDB_EVT_PE_PPS_UPDATE) {
+        pe_sink_save_last_pps(cfg);
+        cfg->pe._last_dpm_request.hdr = cfg->pe.hdr_template
+            | PD_MSGTYPE_REQUEST | PD_NUMOBJ(1);
+        cfg->pe._last_dpm_request.obj[0] = cfg->pps._rdo;
+        /* Tell the protocol layer we're starting an AMS */
+        cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
+        *res = PESinkSelectCap;
+        PT_EXIT(pt);
+    }
+
     /* If SinkPPSPeriodicTimer ran out, send a new request */
     if (evt & PDB_EVT_PE_PPS_REQUEST) {
         /* Tell the protocol layer we're starting an AMS */
@@ -391,6 +1091,33 @@ static PT_THREAD(pe_sink_ready(struct pt *pt, struct pdb_config *cfg, enum polic
         PT_EXIT(pt);
     }
 
+    /* Messages from the source come first, so keeping EPR Mode alive,
+     * entering it, and asking about a source's status wait until any message
+     * is handled */
+    if (evt & PDB_EVT_PE_MSG_RX) {
+        cfg->pe.events |= evt & (PDB_EVT_PE_EPR_ENTER | PDB_EVT_PE_EPR_KEEPALIVE
+                | PDB_EVT_PE_GET_STATUS);
+    /* If the source sent an Alert, find out what's wrong */
+    } else if (evt & PDB_EVT_PE_GET_STATUS) {
+        cfg->pe.events |= evt & (PDB_EVT_PE_EPR_ENTER | PDB_EVT_PE_EPR_KEEPALIVE);
+        /* Tell the protocol layer we're starting an AMS */
+        cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
+        *res = PESinkGetStatus;
+        PT_EXIT(pt);
+    /* If SinkEPRKeepAliveTimer ran out, tell the source we're still here */
+    } else if (evt & PDB_EVT_PE_EPR_KEEPALIVE) {
+        /* Tell the protocol layer we're starting an AMS */
+        cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
+        *res = PESinkEPRKeepAlive;
+        PT_EXIT(pt);
+    /* If we can use more power than SPR allows, enter EPR Mode */
+    } else if (evt & PDB_EVT_PE_EPR_ENTER) {
+        /* Tell the protocol layer we're starting an AMS */
+        cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
+        *res = PESinkEPRModeEntry;
+        PT_EXIT(pt);
+    }
+
     /* If no event was received, the timer ran out. */
     if (evt == 0) {
         /* Repeat our Request message */
@@ -398,124 +1125,11 @@ static PT_THREAD(pe_sink_ready(struct pt *pt, struct pdb_config *cfg, enum polic
         PT_EXIT(pt);
     }
 
-    /* If we received a message */
+    /* If we received a message, handle it */
     if (evt & PDB_EVT_PE_MSG_RX) {
         if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox))) {
-            /* Ignore vendor-defined messages */
-            if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_VENDOR_DEFINED
-                    && PD_NUMOBJ_GET(cfg->pe._message) > 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkReady;
-                PT_EXIT(pt);
-            /* Ignore Ping messages */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_PING
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkReady;
-                PT_EXIT(pt);
-            /* DR_Swap messages are not supported */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_DR_SWAP
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkSendNotSupported;
-                PT_EXIT(pt);
-            /* Get_Source_Cap messages are not supported */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_GET_SOURCE_CAP
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkSendNotSupported;
-                PT_EXIT(pt);
-            /* PR_Swap messages are not supported */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_PR_SWAP
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkSendNotSupported;
-                PT_EXIT(pt);
-            /* VCONN_Swap messages are not supported */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_VCONN_SWAP
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkSendNotSupported;
-                PT_EXIT(pt);
-            /* Request messages are not supported */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_REQUEST
-                    && PD_NUMOBJ_GET(cfg->pe._message) > 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkSendNotSupported;
-                PT_EXIT(pt);
-            /* Sink_Capabilities messages are not supported */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SINK_CAPABILITIES
-                    && PD_NUMOBJ_GET(cfg->pe._message) > 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkSendNotSupported;
-                PT_EXIT(pt);
-            /* Handle GotoMin messages */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_GOTOMIN
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                if (cfg->dpm.giveback_enabled != NULL
-                        && cfg->dpm.giveback_enabled(cfg)) {
-                    /* Transition to the minimum current level */
-                    cfg->dpm.transition_min(cfg);
-                    cfg->pe._min_power = true;
-
-                    cfg->pe._message = NULL;
-                    *res = PESinkTransitionSink;
-                    PT_EXIT(pt);
-                } else {
-                    /* GiveBack is not supported */
-                    cfg->pe._message = NULL;
-                    *res = PESinkSendNotSupported;
-                    PT_EXIT(pt);
-                }
-            /* Evaluate new Source_Capabilities */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOURCE_CAPABILITIES
-                    && PD_NUMOBJ_GET(cfg->pe._message) > 0) {
-                /* Don't free the message: we need to keep the
-                 * Source_Capabilities message so we can evaluate it. */
-                *res = PESinkEvalCap;
-                PT_EXIT(pt);
-            /* Give sink capabilities when asked */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_GET_SINK_CAP
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkGiveSinkCap;
-                PT_EXIT(pt);
-            /* If the message was a Soft_Reset, do the soft reset procedure */
-            } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOFT_RESET
-                    && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                cfg->pe._message = NULL;
-                *res = PESinkSoftReset;
-                PT_EXIT(pt);
-            /* PD 3.0 messges */
-            } else if ((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_3_0) {
-                /* If the message is a multi-chunk extended message, let it
-                 * time out. */
-                if ((cfg->pe._message->hdr & PD_HDR_EXT)
-                        && (PD_DATA_SIZE_GET(cfg->pe._message) > PD_MAX_EXT_MSG_LEGACY_LEN)) {
-                    cfg->pe._message = NULL;
-                    *res = PESinkChunkReceived;
-                    PT_EXIT(pt);
-                /* Tell the DPM a message we sent got a response of
-                 * Not_Supported. */
-                } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_NOT_SUPPORTED
-                        && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
-                    cfg->pe._message = NULL;
-                    *res = PESinkNotSupportedReceived;
-                    PT_EXIT(pt);
-                /* If we got an unknown message, send a soft reset */
-                } else {
-                    cfg->pe._message = NULL;
-                    *res = PESinkSendSoftReset;
-                    PT_EXIT(pt);
-                }
-            /* If we got an unknown message, send a soft reset
-             *
-             * XXX I don't like that this is duplicated. */
-            } else {
-                cfg->pe._message = NULL;
-                *res = PESinkSendSoftReset;
-                PT_EXIT(pt);
-            }
+            *res = pe_sink_ready_dispatch(cfg);
+            PT_EXIT(pt);
         }
     }
 
@@ -581,61 +1195,737 @@ static PT_THREAD(pe_sink_give_sink_cap(struct pt *pt, struct pdb_config *cfg, en
     PT_END(pt);
 }
 
-static PT_THREAD(pe_sink_hard_reset(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+/*
+ * Send the response to a structured VDM request
+ *
+ * The response was made in PESinkReady as soon as the request was read, so
+ * it goes out well within tVDMReceiverResponse.
+ */
+static PT_THREAD(pe_sink_give_vdm(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    /* Transmit the response */
+    pt_queue_push(&cfg->prl.tx_mailbox, cfg->pe._vdm_response);
+    cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
+    static uint32_t evt;
+    PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
+
+    /* If we got reset signaling, transition to default */
+    if (evt & PDB_EVT_PE_RESET) {
+        *res = PESinkTransitionDefault;
+        PT_EXIT(pt);
+    }
+    /* If the message transmission failed, send a soft reset */
+    if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
+        *res = PESinkSendSoftReset;
+        PT_EXIT(pt);
+    }
+
+    *res = PESinkReady;
+    PT_END(pt);
+}
+
+static PT_THREAD(pe_sink_hard_reset(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    /* If we've already sent the maximum number of hard resets, assume the
+     * source is unresponsive. */
+    if (cfg->pe._hard_reset_counter > PD_N_HARD_RESET_COUNT) {
+        *res = PESinkSourceUnresponsive;
+        PT_EXIT(pt);
+    }
+
+    /* Recovery starts now */
+    if (!cfg->pe._hard_reset_recovering) {
+        cfg->pe._hard_reset_recovering = true;
+        cfg->pe._hard_reset_start = micros();
+    }
+
+    /* Generate a hard reset signal, forgetting any word of an earlier one
+     * that came too late */
+    cfg->pe.events &= ~PDB_EVT_PE_HARD_SENT;
+    cfg->prl.hardrst_events |= PDB_EVT_HARDRST_RESET;
+    static uint32_t evt;
+    PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_HARD_SENT, PDB_T_HARD_SENT, &evt);
+
+    /* If the protocol layer didn't send it, it's probably still busy with a
+     * hard reset from the source, waiting for us to finish that one.  Don't
+     * send another after it: carry on with the one in progress. */
+    if (evt == 0) {
+        cfg->prl.hardrst_events &= ~PDB_EVT_HARDRST_RESET;
+        cfg->stats.timeouts[pdb_stats_timer_hard_reset_sent]++;
+    }
+
+    /* Increment HardResetCounter */
+    cfg->pe._hard_reset_counter++;
+
+    *res = PESinkTransitionDefault;
+    PT_END(pt);
+}
+
+static PT_THREAD(pe_sink_transition_default(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    /* If the source started the hard reset, recovery starts now */
+    if (!cfg->pe._hard_reset_recovering) {
+        cfg->pe._hard_reset_recovering = true;
+        cfg->pe._hard_reset_start = micros();
+    }
+
+    cfg->pe._explicit_contract = false;
+    /* Vbus goes back to vSafe5V */
+    cfg->pe._contract_mv = PD_MV_VSAFE5V;
+    cfg->pe._contract_pdo = 0;
+    /* Recovery starts over with soft resets */
+    cfg->pe._recovery_soft_resets = 0;
+    /* A hard reset leaves EPR Mode, and we may try to enter it again */
+    cfg->pe._epr_mode = false;
+    cfg->pe._epr_entry_failed = false;
+    cfg->pe._epr_caps_new = false;
+
+    /* Tell the DPM to transition to default power */
+    cfg->dpm.transition_default(cfg);
+
+    /* There is no local hardware to reset. */
+    /* Since we never change our data role from UFP, there is no reason to set
+     * it here. */
+
+    /* Tell the protocol layer we're done with the reset */
+    cfg->prl.hardrst_events |= PDB_EVT_HARDRST_DONE;
+
+    *res = PESinkStartup;
+    PT_END(pt);
+}
+
+static PT_THREAD(pe_sink_soft_reset(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    /* No need to explicitly reset the protocol layer here.  It resets itself
+     * when a Soft_Reset message is received. */
+
+    /* Get a message object */
+    union pd_msg accept = {0};
+    /* Make an Accept message */
+    accept.hdr = cfg->pe.hdr_template | PD_MSGTYPE_ACCEPT | PD_NUMOBJ(0);
+    /* Transmit the Accept */
+    pt_queue_push(&cfg->prl.tx_mailbox, accept);
+    cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
+    static uint32_t evt;
+    PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
+
+    /* If we got reset signaling, transition to default */
+    if (evt & PDB_EVT_PE_RESET) {
+        *res = PESinkTransitionDefault;
+        PT_EXIT(pt);
+    }
+    /* If the message transmission failed, send a hard reset */
+    if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
+        *res = PESinkHardReset;
+        PT_EXIT(pt);
+    }
+
+    *res = PESinkWaitCap;
+    PT_END(pt);
+}
+
+static PT_THREAD(pe_sink_send_soft_reset(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    /* No need to explicitly reset the protocol layer here.  It resets itself
+     * just before a Soft_Reset message is transmitted. */
+
+    /* Get a message object */
+    union pd_msg softrst = {0};
+    /* Make a Soft_Reset message */
+    softrst.hdr = cfg->pe.hdr_template | PD_MSGTYPE_SOFT_RESET | PD_NUMOBJ(0);
+    /* Transmit the soft reset */
+    pt_queue_push(&cfg->prl.tx_mailbox, softrst);
+    cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
+    static uint32_t evt;
+    PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
+
+    /* If we got reset signaling, transition to default */
+    if (evt & PDB_EVT_PE_RESET) {
+        *res = PESinkTransitionDefault;
+        PT_EXIT(pt);
+    }
+    /* If the message transmission failed, send a hard reset */
+    if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
+        *res = PESinkHardReset;
+        PT_EXIT(pt);
+    }
+
+    /* Wait for a response */
+    PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET, PD_T_SENDER_RESPONSE, &evt);
+    /* If we got reset signaling, transition to default */
+    if (evt & PDB_EVT_PE_RESET) {
+        *res = PESinkTransitionDefault;
+        PT_EXIT(pt);
+    }
+    /* If we didn't get a response before the timeout, send a hard reset */
+    if (evt == 0) {
+        cfg->stats.timeouts[pdb_stats_timer_sender_response]++;
+        *res = PESinkHardReset;
+        PT_EXIT(pt);
+    }
+
+    /* Get the response message */
+    if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox))) {
+        /* If the source accepted our soft reset, wait for capabilities. */
+        if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_ACCEPT)) {
+            cfg->pe._message = NULL;
+            *res = PESinkWaitCap;
+            PT_EXIT(pt);
+        /* If the message was a Soft_Reset, do the soft reset procedure */
+        } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_SOFT_RESET)) {
+            cfg->pe._message = NULL;
+            *res = PESinkSoftReset;
+            PT_EXIT(pt);
+        /* Otherwise, send a hard reset */
+        } else {
+            cfg->pe._message = NULL;
+            *res = PESinkHardReset;
+            PT_EXIT(pt);
+        }
+    }
+    *res = PESinkHardReset;
+    PT_END(pt);
+}
+
+static PT_THREAD(pe_sink_send_not_supported(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    /* Get a message object */
+    union pd_msg not_supported = {};
+
+    if ((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_2_0) {
+        /* Make a Reject message */
+        not_supported.hdr = cfg->pe.hdr_template | PD_MSGTYPE_REJECT | PD_NUMOBJ(0);
+    } else if ((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_3_0) {
+        /* Make a Not_Supported message */
+        not_supported.hdr = cfg->pe.hdr_template | PD_MSGTYPE_NOT_SUPPORTED | PD_NUMOBJ(0);
+    }
+
+    /* Transmit the message */
+    pt_queue_push(&cfg->prl.tx_mailbox, not_supported);
+    cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
+    static uint32_t evt;
+    PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
+
+    /* If we got reset signaling, transition to default */
+    if (evt & PDB_EVT_PE_RESET) {
+        *res = PESinkTransitionDefault;
+        PT_EXIT(pt);
+    }
+    /* If the message transmission failed, send a soft reset */
+    if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
+        *res = PESinkSendSoftReset;
+        PT_EXIT(pt);
+    }
+
+    *res = PESinkReady;
+    PT_END(pt);
+}
+
+static PT_THREAD(pe_sink_chunk_received(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    (void) cfg;
+
+    /* Wait for tChunkingNotSupported */
+    static uint32_t evt;
+    PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_RESET, PD_T_CHUNKING_NOT_SUPPORTED, &evt);
+    /* If we got reset signaling, transition to default */
+    if (evt & PDB_EVT_PE_RESET) {
+        *res = PESinkTransitionDefault;
+    }
+
+    *res = PESinkSendNotSupported;
+    PT_END(pt);
+}
+
+/*
+ * Copy the data of one chunk of an extended message into _ext_msg
+ *
+ * Returns the number of bytes copied, or 0 if the chunk is too short to hold
+ * its part of the message.
+ */
+static uint16_t pe_ext_copy_chunk(struct pdb_config *cfg, const union pd_msg *chunk)
+{
+    uint16_t offset = PD_CHUNK_NUMBER_GET(chunk) * PD_MAX_EXT_MSG_CHUNK_LEN;
+    uint16_t len = PD_MAX_EXT_MSG_CHUNK_LEN;
+    uint8_t numobj = PD_NUMOBJ_GET(chunk);
+
+    /* Don't copy past the end of the message */
+    if (offset >= cfg->pe._ext_msg.size) {
+        return 0;
+    }
+    if (len > cfg->pe._ext_msg.size - offset) {
+        len = cfg->pe._ext_msg.size - offset;
+    }
+    /* Every chunk but the last is full, and the last holds the rest of the
+     * message, so a chunk that's too short would leave a hole */
+    if (numobj == 0 || len > numobj * 4 - 2) {
+        return 0;
+    }
+
+    for (uint16_t i = 0; i < len; i++) {
+        cfg->pe._ext_msg.data[offset + i] = chunk->data[i];
+    }
+    return len;
+}
+
+/*
+ * Receive an extended message, requesting all its chunks after the first
+ *
+ * Every chunk after the first costs a Chunk Request and the chunk itself, so
+ * about two message times plus the source's response time, which it must
+ * keep under tChunkSenderResponse.  A full 260 byte message has ten chunks.
+ */
+static PT_THREAD(pe_sink_receive_extended(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    static uint32_t evt;
+    /* The number of bytes received so far */
+    static uint16_t received;
+    /* The number of the next chunk to ask for */
+    static uint8_t chunk;
+    /* Whether or not the message answers one of ours */
+    static bool solicited;
+
+    solicited = cfg->pe._ext_solicited;
+    cfg->pe._ext_solicited = false;
+
+    /* Start reassembling with the first chunk */
+    cfg->pe._ext_msg.hdr = cfg->pe._message->hdr;
+    cfg->pe._ext_msg.size = PD_DATA_SIZE_GET(cfg->pe._message);
+    if (cfg->pe._ext_msg.size > PD_MAX_EXT_MSG_LEN
+            || PD_CHUNK_NUMBER_GET(cfg->pe._message) != 0) {
+        cfg->pe._message = NULL;
+        *res = PESinkSendNotSupported;
+        PT_EXIT(pt);
+    }
+    received = pe_ext_copy_chunk(cfg, cfg->pe._message);
+    cfg->pe._message = NULL;
+    if (received == 0 && cfg->pe._ext_msg.size != 0) {
+        *res = PESinkSendSoftReset;
+        PT_EXIT(pt);
+    }
+    chunk = 1;
+
+    while (received < cfg->pe._ext_msg.size) {
+        /* Make a Chunk Request for the next chunk */
+        union pd_msg chunk_req = {0};
+        chunk_req.hdr = cfg->pe.hdr_template | PD_HDR_EXT
+            | (cfg->pe._ext_msg.hdr & PD_HDR_MSGTYPE) | PD_NUMOBJ(1);
+        chunk_req.exthdr = PD_EXTHDR_CHUNKED | PD_EXTHDR_REQUEST_CHUNK
+            | PD_CHUNK_NUMBER(chunk) | PD_DATA_SIZE(0);
+        /* Transmit the Chunk Request */
+        pt_queue_push(&cfg->prl.tx_mailbox, chunk_req);
+        cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
+        PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
+
+        /* If we got reset signaling, transition to default */
+        if (evt & PDB_EVT_PE_RESET) {
+            *res = PESinkTransitionDefault;
+            PT_EXIT(pt);
+        }
+        /* If the message transmission failed, send a soft reset */
+        if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
+            *res = PESinkSendSoftReset;
+            PT_EXIT(pt);
+        }
+
+        /* Wait for the chunk */
+        PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET, PD_T_CHUNK_SENDER_RESPONSE, &evt);
+        /* If we got reset signaling, transition to default */
+        if (evt & PDB_EVT_PE_RESET) {
+            *res = PESinkTransitionDefault;
+            PT_EXIT(pt);
+        }
+        /* If the chunk didn't come, give up on the message */
+        if (evt == 0) {
+            cfg->stats.timeouts[pdb_stats_timer_chunk_sender_response]++;
+            *res = cfg->pe._explicit_contract ? PESinkReady : PESinkWaitCap;
+            PT_EXIT(pt);
+        }
+
+        if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox))) {
+            /* If we got the chunk we asked for, add it to the message */
+            if ((cfg->pe._message->hdr & PD_HDR_EXT)
+                    && PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_GET(&cfg->pe._ext_msg)
+                    && (cfg->pe._message->exthdr & PD_EXTHDR_CHUNKED)
+                    && !(cfg->pe._message->exthdr & PD_EXTHDR_REQUEST_CHUNK)
+                    && PD_CHUNK_NUMBER_GET(cfg->pe._message) == chunk) {
+                uint16_t len = pe_ext_copy_chunk(cfg, cfg->pe._message);
+                cfg->pe._message = NULL;
+                /* A short chunk would leave a hole in the message */
+                if (len == 0) {
+                    *res = PESinkSendSoftReset;
+                    PT_EXIT(pt);
+                }
+                received += len;
+                chunk++;
+            /* If the message was a Soft_Reset, do the soft reset procedure */
+            } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_SOFT_RESET)) {
+                cfg->pe._message = NULL;
+                *res = PESinkSoftReset;
+                PT_EXIT(pt);
+            /* Anything else is a protocol error */
+            } else {
+                cfg->pe._message = NULL;
+                *res = PESinkSendSoftReset;
+                PT_EXIT(pt);
+            }
+        }
+    }
+
+    /* Evaluate EPR_Source_Capabilities like any other capabilities */
+    if (PD_MSGTYPE_GET(&cfg->pe._ext_msg) == PD_MSGTYPE_EPR_SOURCE_CAPABILITIES) {
+        /* We only expect them in EPR Mode */
+        if (!cfg->pe._epr_mode) {
+            *res = PESinkSendNotSupported;
+            PT_EXIT(pt);
+        }
+        /* The message has to be made of whole PDOs */
+        if (cfg->pe._ext_msg.size == 0 || cfg->pe._ext_msg.size % 4 != 0
+                || cfg->pe._ext_msg.size / 4 > PD_MAX_EPR_PDOS) {
+            *res = PESinkSendSoftReset;
+            PT_EXIT(pt);
+        }
+        cfg->pe._caps_numobj = cfg->pe._ext_msg.size / 4;
+        for (uint8_t i = 0; i < cfg->pe._caps_numobj; i++) {
+            const uint8_t *pdo = &cfg->pe._ext_msg.data[4 * i];
+            cfg->pe._caps[i] = pdo[0] | (pdo[1] << 8) | (pdo[2] << 16)
+                | ((uint32_t) pdo[3] << 24);
+        }
+        cfg->pe._epr_caps_new = true;
+        *res = PESinkEvalCap;
+        PT_EXIT(pt);
+    }
+
+    /* If the message asks for information about us, respond to it */
+    if (PD_MSGTYPE_GET(&cfg->pe._ext_msg) == PD_MSGTYPE_GET_BATTERY_CAP
+            || PD_MSGTYPE_GET(&cfg->pe._ext_msg) == PD_MSGTYPE_GET_BATTERY_STATUS
+            || PD_MSGTYPE_GET(&cfg->pe._ext_msg) == PD_MSGTYPE_GET_MANUFACTURER_INFO) {
+        *res = PESinkGiveExtended;
+        PT_EXIT(pt);
+    }
+
+    /* Give the DPM the complete message */
+    if (cfg->dpm.extended_msg_received != NULL
+            && cfg->dpm.extended_msg_received(cfg, &cfg->pe._ext_msg)) {
+        *res = PESinkReady;
+        PT_EXIT(pt);
+    }
+
+    /* Replies we asked for are fine to leave unhandled, but anything else
+     * the DPM doesn't want isn't supported */
+    *res = solicited ? PESinkReady : PESinkSendNotSupported;
+    PT_END(pt);
+}
+
+/*
+ * Respond to a request for information about us
+ *
+ * The request is in _ext_msg.  Battery status is sent as a data message;
+ * everything else is an extended message sent by PESinkSendExtended.
+ */
+static PT_THREAD(pe_sink_give_extended(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    /* If we're asked for a battery status, send a Battery_Status message */
+    if ((cfg->pe._ext_msg.hdr & PD_HDR_EXT)
+            && PD_MSGTYPE_GET(&cfg->pe._ext_msg) == PD_MSGTYPE_GET_BATTERY_STATUS) {
+        /* Get the BSDO from the DPM */
+        uint32_t bsdo;
+        if (cfg->pe._ext_msg.size < 1 || cfg->dpm.get_battery_status == NULL
+                || !cfg->dpm.get_battery_status(cfg, cfg->pe._ext_msg.data[0], &bsdo)) {
+            *res = PESinkSendNotSupported;
+            PT_EXIT(pt);
+        }
+        /* Get a message object */
+        union pd_msg bat_status = {0};
+        /* Make a Battery_Status message */
+        bat_status.hdr = cfg->pe.hdr_template | PD_MSGTYPE_BATTERY_STATUS | PD_NUMOBJ(1);
+        bat_status.obj[0] = bsdo;
+
+        /* Transmit the Battery_Status */
+        pt_queue_push(&cfg->prl.tx_mailbox, bat_status);
+        cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
+        static uint32_t evt;
+        PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
+
+        /* If we got reset signaling, transition to default */
+        if (evt & PDB_EVT_PE_RESET) {
+            *res = PESinkTransitionDefault;
+            PT_EXIT(pt);
+        }
+        /* If the message transmission failed, send a soft reset */
+        if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
+            *res = PESinkSendSoftReset;
+            PT_EXIT(pt);
+        }
+
+        *res = PESinkReady;
+        PT_EXIT(pt);
+    }
+
+    /* Otherwise, ask the DPM what to send */
+    cfg->pe._ext_tx.size = 0;
+    cfg->pe._ext_tx.data = NULL;
+    if (cfg->dpm.get_extended_response == NULL
+            || !cfg->dpm.get_extended_response(cfg, &cfg->pe._ext_msg, &cfg->pe._ext_tx)
+            || cfg->pe._ext_tx.size > PD_MAX_EXT_MSG_LEN
+            || (cfg->pe._ext_tx.type & ~PD_HDR_MSGTYPE)) {
+        *res = PESinkSendNotSupported;
+        PT_EXIT(pt);
+    }
+
+    *res = PESinkSendExtended;
+    PT_END(pt);
+}
+
+/*
+ * Transmit the extended message described by _ext_tx
+ *
+ * The first chunk is sent right away.  Each following chunk is only sent when
+ * the receiver asks for it with a Chunk Request, and is taken straight from
+ * the caller's buffer.
+ */
+static PT_THREAD(pe_sink_send_extended(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
+    static uint32_t evt;
+    /* The number of the chunk we're sending */
+    static uint8_t chunk_num;
+    /* When we started waiting for a Chunk Request, so ignored wakeups don't
+     * restart ChunkSenderRequestTimer */
+    static uint64_t start;
+    static uint64_t timeout;
+
+    chunk_num = 0;
+    while (true) {
+        /* Make the chunk */
+        union pd_msg chunk = {0};
+        uint16_t offset = chunk_num * PD_MAX_EXT_MSG_CHUNK_LEN;
+        uint16_t len = cfg->pe._ext_tx.size - offset;
+        if (len > PD_MAX_EXT_MSG_CHUNK_LEN) {
+            len = PD_MAX_EXT_MSG_CHUNK_LEN;
+        }
+        chunk.hdr = cfg->pe.hdr_template | PD_HDR_EXT
+            | (cfg->pe._ext_tx.type & PD_HDR_MSGTYPE) | PD_NUMOBJ((2 + len + 3) / 4);
+        chunk.exthdr = PD_EXTHDR_CHUNKED | PD_CHUNK_NUMBER(chunk_num)
+            | PD_DATA_SIZE(cfg->pe._ext_tx.size);
+        for (uint16_t i = 0; i < len; i++) {
+            chunk.data[i] = cfg->pe._ext_tx.data[offset + i];
+        }
+
+        /* Transmit the chunk */
+        pt_queue_push(&cfg->prl.tx_mailbox, chunk);
+        cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
+        PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
+
+        /* If we got reset signaling, transition to default */
+        if (evt & PDB_EVT_PE_RESET) {
+            *res = PESinkTransitionDefault;
+            PT_EXIT(pt);
+        }
+        /* If the message transmission failed, send a soft reset */
+        if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
+            *res = PESinkSendSoftReset;
+            PT_EXIT(pt);
+        }
+
+        /* If that was the last chunk, we're done */
+        chunk_num++;
+        if (chunk_num * PD_MAX_EXT_MSG_CHUNK_LEN >= cfg->pe._ext_tx.size) {
+            break;
+        }
+
+        /* Wait for the Chunk Request for the next chunk */
+        start = micros();
+        do {
+            timeout = pe_time_left(start, PD_T_CHUNK_SENDER_REQUEST);
+            PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET, timeout, &evt);
+            /* If we got reset signaling, transition to default */
+            if (evt & PDB_EVT_PE_RESET) {
+                *res = PESinkTransitionDefault;
+                PT_EXIT(pt);
+            }
+            /* If nobody asked for the next chunk, we're done */
+            if (evt == 0) {
+                *res = PESinkReady;
+                PT_EXIT(pt);
+            }
+            /* Keep waiting if there wasn't a message after all */
+            cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox);
+        } while (cfg->pe._message == NULL);
+
+        /* If the message was a Soft_Reset, do the soft reset procedure */
+        if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_SOFT_RESET)) {
+            cfg->pe._message = NULL;
+            *res = PESinkSoftReset;
+            PT_EXIT(pt);
+        }
+        /* Anything but a Chunk Request for the next chunk is a protocol
+         * error */
+        if (!(cfg->pe._message->hdr & PD_HDR_EXT)
+                || PD_MSGTYPE_GET(cfg->pe._message) != cfg->pe._ext_tx.type
+                || !(cfg->pe._message->exthdr & PD_EXTHDR_REQUEST_CHUNK)
+                || PD_CHUNK_NUMBER_GET(cfg->pe._message) != chunk_num) {
+            cfg->pe._message = NULL;
+            *res = PESinkSendSoftReset;
+            PT_EXIT(pt);
+        }
+        cfg->pe._message = NULL;
+    }
+
+    *res = PESinkReady;
+    PT_END(pt);
+}
+
+static PT_THREAD(pe_sink_not_supported_received(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
 {
     PT_BEGIN(pt);
-    /* If we've already sent the maximum number of hard resets, assume the
-     * source is unresponsive. */
-    if (cfg->pe._hard_reset_counter > PD_N_HARD_RESET_COUNT) {
-        *res = PESinkSourceUnresponsive;
-        PT_EXIT(pt);
+    /* Inform the Device Policy Manager that we received a Not_Supported
+     * message. */
+    if (cfg->dpm.not_supported_received != NULL) {
+        cfg->dpm.not_supported_received(cfg);
     }
 
-    /* Generate a hard reset signal */
-    cfg->prl.hardrst_events |= PDB_EVT_HARDRST_RESET;
+    *res = PESinkReady;
+    PT_END(pt);
+}
+
+/*
+ * Wait for SinkRequestTimer before repeating a Request the source answered
+ * with Wait
+ */
+static PT_THREAD(pe_sink_wait_retry(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
     static uint32_t evt;
-    PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_HARD_SENT, &evt);
+    /* When we started waiting, so ignored messages don't restart
+     * SinkRequestTimer */
+    static uint64_t start;
+    static uint64_t timeout;
 
-    /* Increment HardResetCounter */
-    cfg->pe._hard_reset_counter++;
+    start = micros();
+    while (true) {
+        timeout = pe_time_left(start, PD_T_SINK_REQUEST);
+        PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET, timeout, &evt);
+        /* If we got reset signaling, transition to default */
+        if (evt & PDB_EVT_PE_RESET) {
+            *res = PESinkTransitionDefault;
+            PT_EXIT(pt);
+        }
+        /* If the timer ran out, repeat our Request */
+        if (evt == 0) {
+            /* Tell the protocol layer we're starting an AMS */
+            cfg->prl.tx_events |= PDB_EVT_PRLTX_START_AMS;
+            *res = PESinkSelectCap;
+            PT_EXIT(pt);
+        }
 
-    *res = PESinkTransitionDefault;
+        /* Read the message.  Keep waiting if it's harmless, or if there
+         * wasn't one after all. */
+        cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox);
+        if (cfg->pe._message == NULL) {
+            continue;
+        }
+        if (PDB_RECOVERY_IGNORE_BENIGN && pe_benign_message(cfg->pe._message)) {
+            cfg->pe._message = NULL;
+            cfg->stats.recovery_ignored++;
+            continue;
+        }
+        break;
+    }
+
+    /* New Source_Capabilities replace the Request we were going to repeat */
+    if (pe_msg_is(cfg->pe._message, pdb_msg_data, PD_MSGTYPE_SOURCE_CAPABILITIES)) {
+        *res = PESinkEvalCap;
+        PT_EXIT(pt);
+    /* If the message was a Soft_Reset, do the soft reset procedure */
+    } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_SOFT_RESET)) {
+        cfg->pe._message = NULL;
+        *res = PESinkSoftReset;
+        PT_EXIT(pt);
+    }
+
+    /* If we got an unexpected message, recover from it */
+    cfg->pe._message = NULL;
+    *res = pe_sink_recover(cfg);
     PT_END(pt);
 }
 
-static PT_THREAD(pe_sink_transition_default(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+/*
+ * When Power Delivery is unresponsive, fall back to Type-C Current
+ */
+static PT_THREAD(pe_sink_source_unresponsive(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
 {
     PT_BEGIN(pt);
-    cfg->pe._explicit_contract = false;
+    /* If the DPM can evaluate the Type-C Current advertisement */
+    if (cfg->dpm.evaluate_typec_current != NULL) {
+        /* Make the DPM evaluate the Type-C Current advertisement */
+        int tcc_match = cfg->dpm.evaluate_typec_current(cfg,
+                fusb_get_typec_current(&cfg->fusb));
 
-    /* Tell the DPM to transition to default power */
-    cfg->dpm.transition_default(cfg);
+        /* If the last two readings are the same, set the output */
+        if (cfg->pe._old_tcc_match == tcc_match) {
+            cfg->dpm.transition_typec(cfg);
+        }
 
-    /* There is no local hardware to reset. */
-    /* Since we never change our data role from UFP, there is no reason to set
-     * it here. */
+        /* Remember whether or not the last measurement succeeded */
+        cfg->pe._old_tcc_match = tcc_match;
+    }
 
-    /* Tell the protocol layer we're done with the reset */
-    cfg->prl.hardrst_events |= PDB_EVT_HARDRST_DONE;
+    /* Wait tPDDebounce between measurements */
+    // (PD_T_PD_DEBOUNCE);
+    PT_YIELD(pt);
+    PT_YIELD(pt);
 
-    *res = PESinkStartup;
+    *res = PESinkSourceUnresponsive;
     PT_END(pt);
 }
 
-static PT_THREAD(pe_sink_soft_reset(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+/*
+ * Find the action of an EPR_Mode message
+ *
+ * Returns the action, or 0 if the message isn't an EPR_Mode message.
+ */
+static uint8_t pe_epr_mode_action(const union pd_msg *msg)
 {
-    PT_BEGIN(pt);
-    /* No need to explicitly reset the protocol layer here.  It resets itself
-     * when a Soft_Reset message is received. */
+    if ((msg->hdr & PD_HDR_EXT)
+            || PD_MSGTYPE_GET(msg) != PD_MSGTYPE_EPR_MODE
+            || PD_NUMOBJ_GET(msg) != 1) {
+        return 0;
+    }
+    return PD_EPRMDO_ACTION_GET(msg);
+}
 
-    /* Get a message object */
-    union pd_msg accept = {0};
-    /* Make an Accept message */
-    accept.hdr = cfg->pe.hdr_template | PD_MSGTYPE_ACCEPT | PD_NUMOBJ(0);
-    /* Transmit the Accept */
-    pt_queue_push(&cfg->prl.tx_mailbox, accept);
-    cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
+/*
+ * Ask the source to enter EPR Mode
+ *
+ * The source acknowledges within tSenderResponse, checks the cable, and
+ * reports success within tEnterEPR.  It then sends EPR_Source_Capabilities,
+ * so we wait for those like any other capabilities.
+ */
+static PT_THREAD(pe_sink_epr_mode_entry(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+{
+    PT_BEGIN(pt);
     static uint32_t evt;
+    static uint8_t action;
+    static uint64_t timeout;
+
+    /* Make an EPR_Mode message asking to enter EPR Mode */
+    union pd_msg enter = {0};
+    enter.hdr = cfg->pe.hdr_template | PD_MSGTYPE_EPR_MODE | PD_NUMOBJ(1);
+    enter.obj[0] = PD_EPRMDO_ACTION_SET(PD_EPRMDO_ACTION_ENTER)
+        | PD_EPRMDO_DATA_SET(cfg->dpm.epr_sink_pdp(cfg));
+    /* Transmit the message */
+    pt_queue_push(&cfg->prl.tx_mailbox, enter);
+    cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
     PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
 
     /* If we got reset signaling, transition to default */
@@ -643,30 +1933,80 @@ static PT_THREAD(pe_sink_soft_reset(struct pt *pt, struct pdb_config *cfg, enum
         *res = PESinkTransitionDefault;
         PT_EXIT(pt);
     }
-    /* If the message transmission failed, send a hard reset */
+    /* If the message transmission failed, send a soft reset */
     if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
-        *res = PESinkHardReset;
+        *res = PESinkSendSoftReset;
         PT_EXIT(pt);
     }
 
+    /* Wait for the source to acknowledge our request, then for it to finish
+     * entering EPR Mode */
+    for (action = PD_EPRMDO_ACTION_ENTER_ACK; action <= PD_EPRMDO_ACTION_ENTER_SUCCEEDED; action++) {
+        timeout = (action == PD_EPRMDO_ACTION_ENTER_ACK) ? PD_T_SENDER_RESPONSE : PD_T_ENTER_EPR;
+        PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET, timeout, &evt);
+        /* If we got reset signaling, transition to default */
+        if (evt & PDB_EVT_PE_RESET) {
+            *res = PESinkTransitionDefault;
+            PT_EXIT(pt);
+        }
+        /* If the source didn't answer in time, send a soft reset */
+        if (evt == 0) {
+            cfg->stats.timeouts[(action == PD_EPRMDO_ACTION_ENTER_ACK)
+                ? pdb_stats_timer_sender_response : pdb_stats_timer_sink_epr_enter]++;
+            *res = PESinkSendSoftReset;
+            PT_EXIT(pt);
+        }
+
+        if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox)) == NULL) {
+            *res = PESinkSendSoftReset;
+            PT_EXIT(pt);
+        }
+        /* If the source refused, stay in SPR Mode and don't ask again */
+        if (pe_epr_mode_action(cfg->pe._message) == PD_EPRMDO_ACTION_ENTER_FAILED) {
+            cfg->pe._epr_entry_failed = true;
+            cfg->pe._message = NULL;
+            *res = PESinkReady;
+            PT_EXIT(pt);
+        /* If the message was a Soft_Reset, do the soft reset procedure */
+        } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_SOFT_RESET)) {
+            cfg->pe._message = NULL;
+            *res = PESinkSoftReset;
+            PT_EXIT(pt);
+        /* Anything but the next step of entry is a protocol error */
+        } else if (pe_epr_mode_action(cfg->pe._message) != action) {
+            cfg->pe._message = NULL;
+            *res = PESinkSendSoftReset;
+            PT_EXIT(pt);
+        }
+        cfg->pe._message = NULL;
+    }
+
+    /* We're in EPR Mode now.  Start SinkEPRKeepAliveTimer and wait for
+     * EPR_Source_Capabilities. */
+    cfg->pe._epr_mode = true;
+    cfg->pe._sink_epr_last_time = micros();
     *res = PESinkWaitCap;
     PT_END(pt);
 }
 
-static PT_THREAD(pe_sink_send_soft_reset(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+/*
+ * Keep EPR Mode alive when we haven't sent anything for a while
+ */
+static PT_THREAD(pe_sink_epr_keepalive(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
 {
     PT_BEGIN(pt);
-    /* No need to explicitly reset the protocol layer here.  It resets itself
-     * just before a Soft_Reset message is transmitted. */
+    static uint32_t evt;
 
-    /* Get a message object */
-    union pd_msg softrst = {0};
-    /* Make a Soft_Reset message */
-    softrst.hdr = cfg->pe.hdr_template | PD_MSGTYPE_SOFT_RESET | PD_NUMOBJ(0);
-    /* Transmit the soft reset */
-    pt_queue_push(&cfg->prl.tx_mailbox, softrst);
+    /* Make an EPR_KeepAlive message */
+    union pd_msg keepalive = {0};
+    keepalive.hdr = cfg->pe.hdr_template | PD_HDR_EXT
+        | PD_MSGTYPE_EXTENDED_CONTROL | PD_NUMOBJ(1);
+    keepalive.exthdr = PD_EXTHDR_CHUNKED | PD_CHUNK_NUMBER(0) | PD_DATA_SIZE(2);
+    keepalive.data[0] = PD_EXTCTRL_EPR_KEEPALIVE;
+    keepalive.data[1] = 0;
+    /* Transmit the message */
+    pt_queue_push(&cfg->prl.tx_mailbox, keepalive);
     cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
-    static uint32_t evt;
     PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
 
     /* If we got reset signaling, transition to default */
@@ -674,68 +2014,67 @@ static PT_THREAD(pe_sink_send_soft_reset(struct pt *pt, struct pdb_config *cfg,
         *res = PESinkTransitionDefault;
         PT_EXIT(pt);
     }
-    /* If the message transmission failed, send a hard reset */
+    /* If the message transmission failed, send a soft reset */
     if ((evt & PDB_EVT_PE_TX_DONE) == 0) {
-        *res = PESinkHardReset;
+        *res = PESinkSendSoftReset;
         PT_EXIT(pt);
     }
+    cfg->pe._sink_epr_last_time = micros();
 
-    /* Wait for a response */
+    /* Wait for the source to acknowledge */
     PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET, PD_T_SENDER_RESPONSE, &evt);
     /* If we got reset signaling, transition to default */
     if (evt & PDB_EVT_PE_RESET) {
         *res = PESinkTransitionDefault;
         PT_EXIT(pt);
     }
-    /* If we didn't get a response before the timeout, send a hard reset */
+    /* If the source didn't answer, it has probably left EPR Mode */
     if (evt == 0) {
+        cfg->stats.timeouts[pdb_stats_timer_sender_response]++;
         *res = PESinkHardReset;
         PT_EXIT(pt);
     }
 
-    /* Get the response message */
     if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox))) {
-        /* If the source accepted our soft reset, wait for capabilities. */
-        if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_ACCEPT
-                && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
+        /* If we got an EPR_KeepAlive_Ack, we're done */
+        if ((cfg->pe._message->hdr & PD_HDR_EXT)
+                && PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_EXTENDED_CONTROL
+                && PD_DATA_SIZE_GET(cfg->pe._message) == 2
+                && cfg->pe._message->data[0] == PD_EXTCTRL_EPR_KEEPALIVE_ACK) {
             cfg->pe._message = NULL;
-            *res = PESinkWaitCap;
+            *res = PESinkReady;
             PT_EXIT(pt);
         /* If the message was a Soft_Reset, do the soft reset procedure */
-        } else if (PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_SOFT_RESET
-                && PD_NUMOBJ_GET(cfg->pe._message) == 0) {
+        } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_SOFT_RESET)) {
             cfg->pe._message = NULL;
             *res = PESinkSoftReset;
             PT_EXIT(pt);
-        /* Otherwise, send a hard reset */
-        } else {
-            cfg->pe._message = NULL;
-            *res = PESinkHardReset;
-            PT_EXIT(pt);
         }
+        cfg->pe._message = NULL;
     }
-    *res = PESinkHardReset;
+
+    /* Anything else is a protocol error */
+    *res = PESinkSendSoftReset;
     PT_END(pt);
 }
 
-static PT_THREAD(pe_sink_send_not_supported(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
+/*
+ * Ask the source for its status after an Alert
+ *
+ * The Status message comes back as an extended message, so it's received by
+ * PESinkReceiveExtended and handed to the DPM from there.
+ */
+static PT_THREAD(pe_sink_get_status(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
 {
     PT_BEGIN(pt);
-    /* Get a message object */
-    union pd_msg not_supported = {};
-
-    if ((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_2_0) {
-        /* Make a Reject message */
-        not_supported.hdr = cfg->pe.hdr_template | PD_MSGTYPE_REJECT | PD_NUMOBJ(0);
-    } else if ((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_3_0) {
-        /* Make a Not_Supported message */
-        not_supported.hdr = cfg->pe.hdr_template | PD_MSGTYPE_NOT_SUPPORTED | PD_NUMOBJ(0);
-    }
+    static uint32_t evt;
 
+    /* Make a Get_Status message */
+    union pd_msg get_status = {0};
+    get_status.hdr = cfg->pe.hdr_template | PD_MSGTYPE_GET_STATUS | PD_NUMOBJ(0);
     /* Transmit the message */
-    pt_queue_push(&cfg->prl.tx_mailbox, not_supported);
+    pt_queue_push(&cfg->prl.tx_mailbox, get_status);
     cfg->prl.tx_events |= PDB_EVT_PRLTX_MSG_TX;
-    static uint32_t evt;
     PT_EVT_WAIT(pt, &cfg->pe.events, PDB_EVT_PE_TX_DONE | PDB_EVT_PE_TX_ERR | PDB_EVT_PE_RESET, &evt);
 
     /* If we got reset signaling, transition to default */
@@ -749,67 +2088,45 @@ static PT_THREAD(pe_sink_send_not_supported(struct pt *pt, struct pdb_config *cf
         PT_EXIT(pt);
     }
 
-    *res = PESinkReady;
-    PT_END(pt);
-}
-
-static PT_THREAD(pe_sink_chunk_received(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
-{
-    PT_BEGIN(pt);
-    (void) cfg;
-
-    /* Wait for tChunkingNotSupported */
-    static uint32_t evt;
-    PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_RESET, PD_T_CHUNKING_NOT_SUPPORTED, &evt);
+    /* Wait for the Status */
+    PT_EVT_WAIT_TO(pt, &cfg->pe.events, PDB_EVT_PE_MSG_RX | PDB_EVT_PE_RESET, PD_T_SENDER_RESPONSE, &evt);
     /* If we got reset signaling, transition to default */
     if (evt & PDB_EVT_PE_RESET) {
         *res = PESinkTransitionDefault;
+        PT_EXIT(pt);
     }
-
-    *res = PESinkSendNotSupported;
-    PT_END(pt);
-}
-
-static PT_THREAD(pe_sink_not_supported_received(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
-{
-    PT_BEGIN(pt);
-    /* Inform the Device Policy Manager that we received a Not_Supported
-     * message. */
-    if (cfg->dpm.not_supported_received != NULL) {
-        cfg->dpm.not_supported_received(cfg);
+    /* If the source didn't answer, there's nothing more to learn */
+    if (evt == 0) {
+        cfg->stats.timeouts[pdb_stats_timer_sender_response]++;
+        *res = PESinkReady;
+        PT_EXIT(pt);
     }
 
-    *res = PESinkReady;
-    PT_END(pt);
-}
-
-/*
- * When Power Delivery is unresponsive, fall back to Type-C Current
- */
-static PT_THREAD(pe_sink_source_unresponsive(struct pt *pt, struct pdb_config *cfg, enum policy_engine_state *res))
-{
-    PT_BEGIN(pt);
-    /* If the DPM can evaluate the Type-C Current advertisement */
-    if (cfg->dpm.evaluate_typec_current != NULL) {
-        /* Make the DPM evaluate the Type-C Current advertisement */
-        int tcc_match = cfg->dpm.evaluate_typec_current(cfg,
-                fusb_get_typec_current(&cfg->fusb));
-
-        /* If the last two readings are the same, set the output */
-        if (cfg->pe._old_tcc_match == tcc_match) {
-            cfg->dpm.transition_typec(cfg);
+    if ((cfg->pe._message = pt_queue_pop(&cfg->pe.mailbox))) {
+        /* If we got the first chunk of a Status, receive the rest */
+        if ((cfg->pe._message->hdr & PD_HDR_EXT)
+                && PD_MSGTYPE_GET(cfg->pe._message) == PD_MSGTYPE_STATUS
+                && !(cfg->pe._message->exthdr & PD_EXTHDR_REQUEST_CHUNK)) {
+            /* Don't free the message: we need its first chunk */
+            cfg->pe._ext_solicited = true;
+            *res = PESinkReceiveExtended;
+            PT_EXIT(pt);
+        /* If the source doesn't support Get_Status, we're done */
+        } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_NOT_SUPPORTED)) {
+            cfg->pe._message = NULL;
+            *res = PESinkReady;
+            PT_EXIT(pt);
+        /* If the message was a Soft_Reset, do the soft reset procedure */
+        } else if (pe_msg_is(cfg->pe._message, pdb_msg_control, PD_MSGTYPE_SOFT_RESET)) {
+            cfg->pe._message = NULL;
+            *res = PESinkSoftReset;
+            PT_EXIT(pt);
         }
-
-        /* Remember whether or not the last measurement succeeded */
-        cfg->pe._old_tcc_match = tcc_match;
+        cfg->pe._message = NULL;
     }
 
-    /* Wait tPDDebounce between measurements */
-    // (PD_T_PD_DEBOUNCE);
-    PT_YIELD(pt);
-    PT_YIELD(pt);
-
-    *res = PESinkSourceUnresponsive;
+    /* Anything else is a protocol error */
+    *res = PESinkSendSoftReset;
     PT_END(pt);
 }
 
@@ -819,21 +2136,43 @@ static PT_THREAD(pe_sink_source_unresponsive(struct pt *pt, struct pdb_config *c
 static PT_THREAD(PolicyEngine(struct pt *pt, struct pdb_config *cfg))
 {
     PT_BEGIN(pt);
-    static enum policy_engine_state state = PESinkStartup;
+    static enum policy_engine_state state;
     static struct pt child;
 
+    /* Start from the beginning, even if a previous session left off
+     * somewhere else */
+    state = PESinkStartup;
+
     /* Initialize the mailbox */
     cfg->pe.mailbox.r = 0;
     cfg->pe.mailbox.w = 0;
+    /* No hard resets have been sent in this session */
+    cfg->pe._hard_reset_counter = 0;
     /* Initialize the timebase for SinkPPSPeriodicTimer */
-    cfg->pe._sink_pps_last_time = 0;
-    cfg->pe._sink_pps_timer_enabled = false;
+    cfg->pe._sink_apdo_last_time = 0;
+    cfg->pe._sink_apdo_timer_enabled = false;
+    /* Nothing has been recovered from yet */
+    cfg->pe._recovery_soft_resets = 0;
+    cfg->pe._hard_reset_recovering = false;
     /* Initialize the old_tcc_match */
     cfg->pe._old_tcc_match = -1;
     /* Initialize the pps_index */
-    cfg->pe._pps_index = 8;
+    cfg->pe._pps_index = 0;
     /* Initialize the last_pps */
-    cfg->pe._last_pps = 8;
+    cfg->pe._last_pps = 0;
+    /* We start out in SPR Mode */
+    cfg->pe._epr_mode = false;
+    cfg->pe._epr_entry_failed = false;
+    cfg->pe._epr_caps_new = false;
+    cfg->pe._ext_solicited = false;
+    /* We start out cool, at full power */
+    cfg->pe._derate_level = 0;
+    cfg->pe._overtemp = false;
+    /* Before any contract, we have vSafe5V */
+    cfg->pe._contract_mv = PD_MV_VSAFE5V;
+    cfg->pe._contract_pdo = 0;
+    /* Start with nothing in the capabilities cache */
+    cfg->pe._caps_cache_valid = false;
     /* Initialize the PD message header template */
     cfg->pe.hdr_template = PD_DATAROLE_UFP | PD_POWERROLE_SINK;
 
@@ -890,6 +2229,30 @@ static PT_THREAD(PolicyEngine(struct pt *pt, struct pdb_config *cfg))
             case PESinkNotSupportedReceived:
                 PT_SPAWN(pt, &child, pe_sink_not_supported_received(&child, cfg, &state));
                 break;
+            case PESinkWaitRetry:
+                PT_SPAWN(pt, &child, pe_sink_wait_retry(&child, cfg, &state));
+                break;
+            case PESinkReceiveExtended:
+                PT_SPAWN(pt, &child, pe_sink_receive_extended(&child, cfg, &state));
+                break;
+            case PESinkGiveExtended:
+                PT_SPAWN(pt, &child, pe_sink_give_extended(&child, cfg, &state));
+                break;
+            case PESinkSendExtended:
+                PT_SPAWN(pt, &child, pe_sink_send_extended(&child, cfg, &state));
+                break;
+            case PESinkEPRModeEntry:
+                PT_SPAWN(pt, &child, pe_sink_epr_mode_entry(&child, cfg, &state));
+                break;
+            case PESinkEPRKeepAlive:
+                PT_SPAWN(pt, &child, pe_sink_epr_keepalive(&child, cfg, &state));
+                break;
+            case PESinkGetStatus:
+                PT_SPAWN(pt, &child, pe_sink_get_status(&child, cfg, &state));
+                break;
+            case PESinkGiveVDM:
+                PT_SPAWN(pt, &child, pe_sink_give_vdm(&child, cfg, &state));
+                break;
             default:
                 /* This is an error.  It really shouldn't happen.  We might
                  * want to handle it anyway, though. */
@@ -901,16 +2264,49 @@ static PT_THREAD(PolicyEngine(struct pt *pt, struct pdb_config *cfg))
     PT_END(pt);
 }
 
+void pdb_pe_new_power(struct pdb_config *cfg)
+{
+    /* A Request is already on its way, and it will be made from the DPM's
+     * latest wishes */
+    if (cfg->pe.events & PDB_EVT_PE_NEW_POWER) {
+        cfg->stats.coalesced_requests++;
+    }
+    cfg->pe.events |= PDB_EVT_PE_NEW_POWER;
+}
+
+void pdb_pe_invalidate_caps_cache(struct pdb_config *cfg)
+{
+    cfg->pe._caps_cache_valid = false;
+}
+
 void pdb_pe_run(struct pdb_config *cfg)
 {
     (void)PT_SCHEDULE(PolicyEngine(&cfg->pe.thread, cfg));
 
-    if (cfg->pe._sink_pps_timer_enabled) {
-        uint32_t now = millis();
-        if (now - cfg->pe._sink_pps_last_time > PD_T_PPS_REQUEST) {
-            /* Signal the PE thread to make a new PPS request */
-            cfg->pe.events |= PDB_EVT_PE_PPS_REQUEST;
-            cfg->pe._sink_pps_last_time = now;
+    if (cfg->pe._sink_apdo_timer_enabled
+            && pt_time_expired(cfg->pe._sink_apdo_last_time, PD_T_PPS_REQUEST)) {
+        /* Signal the PE thread to make a new PPS request */
+        cfg->pe.events |= PDB_EVT_PE_PPS_REQUEST;
+        cfg->pe._sink_apdo_last_time = micros();
+    }
+
+    if (cfg->pe._epr_mode && cfg->pe._explicit_contract
+            && pt_time_expired(cfg->pe._sink_epr_last_time, PD_T_SINK_EPR_KEEPALIVE)) {
+        /* Signal the PE thread to send an EPR_KeepAlive */
+        cfg->pe.events |= PDB_EVT_PE_EPR_KEEPALIVE;
+        cfg->pe._sink_epr_last_time = micros();
+    }
+
+    /* The cooldown only starts once the FUSB302B stops being too hot, and
+     * each step back up needs a whole cooldown of its own, so power comes
+     * back gradually rather than flapping around the temperature limit. */
+    if (cfg->pe._derate_level > 0) {
+        if (cfg->pe._overtemp) {
+            cfg->pe._derate_last_time = micros();
+        } else if (pt_time_expired(cfg->pe._derate_last_time, PDB_T_DERATE_COOLDOWN)) {
+            /* Signal the PE thread to step power back up */
+            cfg->pe.events |= PDB_EVT_PE_COOLED;
+            cfg->pe._derate_last_time = micros();
         }
     }
 }
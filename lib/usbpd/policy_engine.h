@@ -33,6 +33,11 @@
 #define PDB_EVT_PE_HARD_SENT PDB_EVENT_MASK(4)
 #define PDB_EVT_PE_I_OVRTEMP PDB_EVENT_MASK(5)
 #define PDB_EVT_PE_PPS_REQUEST PDB_EVENT_MASK(6)
+#define PDB_EVT_PE_PPS_UPDATE PDB_EVENT_MASK(9)
+#define PDB_EVT_PE_EPR_ENTER PDB_EVENT_MASK(10)
+#define PDB_EVT_PE_EPR_KEEPALIVE PDB_EVENT_MASK(11)
+#define PDB_EVT_PE_COOLED PDB_EVENT_MASK(12)
+#define PDB_EVT_PE_GET_STATUS PDB_EVENT_MASK(13)
 
 /*
  * Schedule  the Policy Engine thread
@@ -0,0 +1,130 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "pps.h"
+
+#include <stddef.h>
+
+#include <pd.h>
+#include "policy_engine.h"
+
+#include "pt-evt.h"
+
+/* Minimum time between two Requests made by the controller */
+#define PDB_T_PPS_UPDATE TIME_MS2I(250)
+/* Largest voltage change made by a single Request, in PRV */
+#define PDB_PPS_MAX_STEP PD_MV2PRV(500)
+
+
+void pdb_pps_set_target(struct pdb_config *cfg, uint16_t mv, uint16_t ma)
+{
+    cfg->pps._target_mv = mv;
+    cfg->pps._target_ma = ma;
+    cfg->pps._enabled = true;
+}
+
+void pdb_pps_stop(struct pdb_config *cfg)
+{
+    cfg->pps._enabled = false;
+}
+
+/*
+ * Find the PPS APDO the controller should request from.
+ *
+ * Returns the object position of the APDO, or 0 if there is none.
+ */
+static uint8_t pps_find_apdo(struct pdb_config *cfg)
+{
+    uint8_t pos = PD_RDO_OBJPOS_GET(&cfg->pe._last_dpm_request);
+
+    /* If the current contract is from a PPS APDO, keep using it */
+    if (pos != 0 && pos <= cfg->pe._caps_numobj
+            && PD_APDO_IS_PPS(cfg->pe._caps[pos - 1])) {
+        return pos;
+    }
+
+    /* Otherwise, use the first one, if there is one */
+    return cfg->pe._pps_index;
+}
+
+void pdb_pps_run(struct pdb_config *cfg)
+{
+    /* Only make Requests when we have a setpoint and a contract to change */
+    if (!cfg->pps._enabled || !cfg->pe._explicit_contract) {
+        return;
+    }
+    /* Don't make a new Request until the Policy Engine took the last one */
+    if (cfg->pe.events & PDB_EVT_PE_PPS_UPDATE) {
+        return;
+    }
+    /* Limit the rate of our Requests */
+    if (!pt_time_expired(cfg->pps._last_time, PDB_T_PPS_UPDATE)) {
+        return;
+    }
+
+    uint8_t pos = pps_find_apdo(cfg);
+    if (pos == 0) {
+        return;
+    }
+    uint32_t apdo = cfg->pe._caps[pos - 1];
+    int32_t min_prv = PD_MV2PRV(PD_PAV2MV(PD_APDO_PPS_MIN_VOLTAGE_GET(apdo)));
+    int32_t max_prv = PD_MV2PRV(PD_PAV2MV(PD_APDO_PPS_MAX_VOLTAGE_GET(apdo)));
+
+    /* If we're already on this APDO, step from the voltage we have towards
+     * the target by the measured error.  Otherwise, start at the target. */
+    const union pd_msg *last = &cfg->pe._last_dpm_request;
+    int32_t prv = PD_MV2PRV(cfg->pps._target_mv);
+    if (pos == PD_RDO_OBJPOS_GET(last) && cfg->dpm.pps_feedback != NULL) {
+        int32_t step = PD_MV2PRV((int32_t) cfg->pps._target_mv
+                - (int32_t) cfg->dpm.pps_feedback(cfg));
+        if (step > PDB_PPS_MAX_STEP) {
+            step = PDB_PPS_MAX_STEP;
+        } else if (step < -PDB_PPS_MAX_STEP) {
+            step = -PDB_PPS_MAX_STEP;
+        }
+        prv = ((last->obj[0] & PD_RDO_PROG_VOLTAGE) >> PD_RDO_PROG_VOLTAGE_SHIFT)
+            + step;
+    }
+    if (prv < min_prv) {
+        prv = min_prv;
+    } else if (prv > max_prv) {
+        prv = max_prv;
+    }
+
+    /* Work out the current to request */
+    uint32_t pai = PD_MA2PAI((uint32_t) cfg->pps._target_ma);
+    if (pai > PD_APDO_PPS_CURRENT_GET(apdo)) {
+        pai = PD_APDO_PPS_CURRENT_GET(apdo);
+    }
+
+    /* Make the Request, keeping the flags the DPM chose */
+    uint32_t rdo = (last->obj[0]
+            & (PD_RDO_USB_COMMS | PD_RDO_NO_USB_SUSPEND | PD_RDO_UNCHUNKED_EXT_MSG
+                | PD_RDO_EPR_CAPABLE))
+        | PD_RDO_PROG_VOLTAGE_SET(prv) | PD_RDO_PROG_CURRENT_SET(pai)
+        | PD_RDO_OBJPOS_SET(pos);
+
+    /* If we already have what we want, there's nothing to do */
+    if (rdo == last->obj[0]) {
+        return;
+    }
+    cfg->pps._rdo = rdo;
+    cfg->pps._last_time = micros();
+
+    /* Hand the Request to the Policy Engine */
+    cfg->pe.events |= PDB_EVT_PE_PPS_UPDATE;
+}
@@ -0,0 +1,28 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_PPS_CONTROLLER_H
+#define PDB_PPS_CONTROLLER_H
+
+#include <pdb.h>
+
+/*
+ * Run the PPS controller
+ */
+void pdb_pps_run(struct pdb_config *cfg);
+
+#endif /* PDB_PPS_CONTROLLER_H */
@@ -23,6 +23,8 @@
 #include "policy_engine.h"
 #include "protocol_tx.h"
 #include "fusb302b.h"
+#include "pkt.h"
+#include "timing.h"
 
 #include "pt.h"
 #include "pt-evt.h"
@@ -61,11 +63,25 @@ static PT_THREAD(protocol_rx_wait_phy(struct pt *pt, struct pdb_config *cfg, enu
         /* Get a buffer to read the message into.  Guaranteed to not fail
          * because we have a big enough pool and are careful. */
         cfg->prl._rx_message = pd_msg_empty;
-        /* Read the message */
-        fusb_read_message(&cfg->fusb, &cfg->prl._rx_message);
+        /* Read the message, dropping it if the FIFO didn't hold one */
+        if (fusb_read_message(&cfg->fusb, &cfg->prl._rx_message) != 0) {
+            cfg->stats.rx_dropped++;
+            *res = PRLRxWaitPHY;
+            PT_EXIT(pt);
+        }
+        /* Extended messages always have at least the extended header in
+         * their first data object, so drop any that don't */
+        if ((cfg->prl._rx_message.hdr & PD_HDR_EXT)
+                && PD_NUMOBJ_GET(&cfg->prl._rx_message) == 0) {
+            cfg->stats.rx_dropped++;
+            *res = PRLRxWaitPHY;
+            PT_EXIT(pt);
+        }
         /* If it's a Soft_Reset, go to the soft reset state */
         if (PD_MSGTYPE_GET(&cfg->prl._rx_message) == PD_MSGTYPE_SOFT_RESET
-                && PD_NUMOBJ_GET(&cfg->prl._rx_message) == 0) {
+                && PD_NUMOBJ_GET(&cfg->prl._rx_message) == 0
+                && !(cfg->prl._rx_message.hdr & PD_HDR_EXT)) {
+            cfg->stats.soft_resets_received++;
             *res = PRLRxReset;
             PT_EXIT(pt);
         /* Otherwise, check the message ID */
@@ -124,6 +140,7 @@ static PT_THREAD(protocol_rx_check_messageid(struct pt *pt, struct pdb_config *c
     /* If the message has the stored ID, we've seen this message before.  Free
      * it and don't pass it to the policy engine. */
     if (PD_MESSAGEID_GET(&cfg->prl._rx_message) == cfg->prl._rx_messageid) {
+        cfg->stats.rx_duplicates++;
         cfg->prl._rx_message = pd_msg_empty;
         *res = PRLRxWaitPHY;
         PT_EXIT(pt);
@@ -150,7 +167,14 @@ static PT_THREAD(protocol_rx_store_messageid(struct pt *pt, struct pdb_config *c
     cfg->prl._rx_messageid = PD_MESSAGEID_GET(&cfg->prl._rx_message);
 
     /* Pass the message to the policy engine. */
-    pt_queue_push(&cfg->pe.mailbox, cfg->prl._rx_message);
+    if (pt_queue_push(&cfg->pe.mailbox, cfg->prl._rx_message)) {
+        pdb_pkt_capture(cfg, pdb_pkt_rx, &cfg->prl._rx_message);
+        pdb_timing_rx(cfg, &cfg->prl._rx_message);
+        cfg->stats.rx[PDB_MSG_CLASS_GET(&cfg->prl._rx_message)]
+            [PD_MSGTYPE_GET(&cfg->prl._rx_message)]++;
+    } else {
+        cfg->stats.rx_mailbox_overflows++;
+    }
     cfg->pe.events |= PDB_EVT_PE_MSG_RX;
 
     /* Don't check if we got a RESET because we'd do nothing different. */
@@ -165,9 +189,11 @@ static PT_THREAD(protocol_rx_store_messageid(struct pt *pt, struct pdb_config *c
 static PT_THREAD(ProtocolRX(struct pt *pt, struct pdb_config *cfg))
 {
     PT_BEGIN(pt);
-    static enum protocol_rx_state state = PRLRxWaitPHY;
+    static enum protocol_rx_state state;
     static struct pt child;
 
+    state = PRLRxWaitPHY;
+
     while (true) {
         switch (state) {
             case PRLRxWaitPHY:
@@ -21,6 +21,8 @@
 #include "policy_engine.h"
 #include "protocol_rx.h"
 #include "fusb302b.h"
+#include "pkt.h"
+#include "timing.h"
 
 #include "pt.h"
 #include "pt-evt.h"
@@ -93,9 +95,16 @@ static PT_THREAD(protocol_tx_wait_message(struct pt *pt, struct pdb_config *cfg,
     if (evt & PDB_EVT_PRLTX_MSG_TX) {
         /* Get the message */
         cfg->prl._tx_message = pt_queue_pop(&cfg->prl.tx_mailbox);
+        /* If there isn't one after all, keep waiting */
+        if (cfg->prl._tx_message == NULL) {
+            *res = PRLTxWaitMessage;
+            PT_EXIT(pt);
+        }
         /* If it's a Soft_Reset, reset the TX layer first */
         if (PD_MSGTYPE_GET(cfg->prl._tx_message) == PD_MSGTYPE_SOFT_RESET
-                && PD_NUMOBJ_GET(cfg->prl._tx_message) == 0) {
+                && PD_NUMOBJ_GET(cfg->prl._tx_message) == 0
+                && !(cfg->prl._tx_message->hdr & PD_HDR_EXT)) {
+            cfg->stats.soft_resets_sent++;
             *res = PRLTxReset;
             PT_EXIT(pt);
         /* Otherwise, just send the message */
@@ -160,6 +169,8 @@ static PT_THREAD(protocol_tx_construct_message(struct pt *pt, struct pdb_config
 
     /* Send the message to the PHY */
     fusb_send_message(&cfg->fusb, cfg->prl._tx_message);
+    pdb_pkt_capture(cfg, pdb_pkt_tx, cfg->prl._tx_message);
+    pdb_timing_tx(cfg, cfg->prl._tx_message);
 
     *res = PRLTxWaitResponse;
     PT_END(pt);
@@ -194,6 +205,7 @@ static PT_THREAD(protocol_tx_wait_response(struct pt *pt, struct pdb_config *cfg
     }
     /* If the message failed to be sent */
     if (evt & PDB_EVT_PRLTX_I_RETRYFAIL) {
+        cfg->stats.tx_retry_fails++;
         *res = PRLTxTransmissionError;
         PT_EXIT(pt);
     }
@@ -221,6 +233,7 @@ static PT_THREAD(protocol_tx_match_messageid(struct pt *pt, struct pdb_config *c
         *res = PRLTxMessageSent;
         PT_EXIT(pt);
     } else {
+        cfg->stats.tx_goodcrc_mismatches++;
         *res = PRLTxTransmissionError;
         PT_EXIT(pt);
     }
@@ -250,6 +263,9 @@ static PT_THREAD(protocol_tx_message_sent(struct pt *pt, struct pdb_config *cfg,
     /* Tell the policy engine that we succeeded */
     cfg->pe.events |= PDB_EVT_PE_TX_DONE;
 
+    cfg->stats.tx[PDB_MSG_CLASS_GET(cfg->prl._tx_message)]
+        [PD_MSGTYPE_GET(cfg->prl._tx_message)]++;
+
     cfg->prl._tx_message = NULL;
     *res = PRLTxWaitMessage;
     PT_END(pt);
@@ -261,6 +277,7 @@ static PT_THREAD(protocol_tx_discard_message(struct pt *pt, struct pdb_config *c
     /* If we were working on sending a message, increment MessageIDCounter */
     if (cfg->prl._tx_message != NULL) {
         cfg->prl._tx_messageidcounter = (cfg->prl._tx_messageidcounter + 1) % 8;
+        cfg->stats.tx_discarded++;
     }
 
     *res = PRLTxPHYReset;
@@ -273,9 +290,11 @@ static PT_THREAD(protocol_tx_discard_message(struct pt *pt, struct pdb_config *c
 static PT_THREAD(ProtocolTX(struct pt *pt, struct pdb_config *cfg))
 {
     PT_BEGIN(pt);
-    static enum protocol_tx_state state = PRLTxPHYReset;
+    static enum protocol_tx_state state;
     static struct pt child;
 
+    state = PRLTxPHYReset;
+
     /* Initialize the mailbox */
     cfg->prl.tx_mailbox.r = 0;
     cfg->prl.tx_mailbox.w = 0;
@@ -0,0 +1,220 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "timing.h"
+
+#include <stddef.h>
+#include <string.h>
+
+#include <pd.h>
+
+#include "pt-evt.h"
+
+/*
+ * The longest acceptable gap between calls to pdb_poll.  Well within
+ * tReceiverResponse, so that a slow main loop is caught before it makes us
+ * miss a deadline.
+ */
+#ifndef PDB_T_POLL_MAX
+#define PDB_T_POLL_MAX TIME_MS2I(5)
+#endif
+
+#define PDB_TIMING_TYPE(type) ((uint32_t) 1 << (type))
+
+/*
+ * Messages the source sends that we must answer, by class and type
+ */
+static const uint32_t timing_rx_needs_response[PDB_MSG_NUM_CLASSES] = {
+    [pdb_msg_control] = PDB_TIMING_TYPE(PD_MSGTYPE_GET_SOURCE_CAP)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_GET_SINK_CAP)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_DR_SWAP)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_PR_SWAP)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_VCONN_SWAP)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_SOFT_RESET)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_GET_SINK_CAP_EXTENDED),
+    [pdb_msg_data] = PDB_TIMING_TYPE(PD_MSGTYPE_SOURCE_CAPABILITIES),
+    [pdb_msg_extended] = 0
+};
+
+/*
+ * Messages we send that the source must answer, by class and type
+ */
+static const uint32_t timing_tx_needs_response[PDB_MSG_NUM_CLASSES] = {
+    [pdb_msg_control] = PDB_TIMING_TYPE(PD_MSGTYPE_GET_SOURCE_CAP)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_SOFT_RESET)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_GET_STATUS),
+    [pdb_msg_data] = PDB_TIMING_TYPE(PD_MSGTYPE_REQUEST)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_EPR_REQUEST)
+        | PDB_TIMING_TYPE(PD_MSGTYPE_EPR_MODE),
+    [pdb_msg_extended] = 0
+};
+
+/*
+ * Record a measurement, telling the DPM if it's a violation
+ */
+static void timing_record(struct pdb_config *cfg, enum pdb_timing_check check,
+        uint64_t elapsed, bool violation)
+{
+    struct pdb_timing_stats *stats = &cfg->timing.checks[check];
+    uint32_t us = (elapsed > UINT32_MAX) ? UINT32_MAX : (uint32_t) elapsed;
+
+    stats->count++;
+    stats->last = us;
+    if (us > stats->max) {
+        stats->max = us;
+    }
+    if (violation) {
+        stats->violations++;
+        if (cfg->dpm.timing_violation != NULL) {
+            cfg->dpm.timing_violation(cfg, check, us);
+        }
+    }
+}
+
+/*
+ * Record a measurement that must not be over the limit
+ */
+static void timing_measure(struct pdb_config *cfg, enum pdb_timing_check check,
+        uint64_t elapsed, uint64_t limit)
+{
+    timing_record(cfg, check, elapsed, elapsed > limit);
+}
+
+void pdb_timing_init(struct pdb_config *cfg)
+{
+    memset(&cfg->timing, 0, sizeof(cfg->timing));
+}
+
+void pdb_timing_hard_reset(struct pdb_config *cfg)
+{
+    cfg->timing._rx_pending = false;
+    cfg->timing._tx_pending = false;
+    cfg->timing._accept_pending = false;
+    cfg->timing._wait_pending = false;
+    cfg->timing._request_valid = false;
+}
+
+void pdb_timing_rx(struct pdb_config *cfg, const union pd_msg *msg)
+{
+    uint64_t now = micros();
+    enum pdb_msg_class msg_class = PDB_MSG_CLASS_GET(msg);
+    uint8_t type = PD_MSGTYPE_GET(msg);
+
+    /* Anything the source sends after a message of ours that needs a
+     * response is its response */
+    if (cfg->timing._tx_pending) {
+        cfg->timing._tx_pending = false;
+        timing_measure(cfg, pdb_timing_source_response,
+                now - cfg->timing._tx_time, PD_T_RECEIVER_RESPONSE);
+
+        /* If it accepted our Request, wait for PS_RDY */
+        if (cfg->timing._tx_request && msg_class == pdb_msg_control
+                && type == PD_MSGTYPE_ACCEPT) {
+            cfg->timing._accept_time = now;
+            cfg->timing._accept_pending = true;
+        }
+        /* If it told us to wait, our next Request must not come too soon */
+        if (cfg->timing._tx_request && msg_class == pdb_msg_control
+                && type == PD_MSGTYPE_WAIT) {
+            cfg->timing._wait_time = now;
+            cfg->timing._wait_pending = true;
+        }
+    } else if (cfg->timing._accept_pending && msg_class == pdb_msg_control
+            && type == PD_MSGTYPE_PS_RDY) {
+        cfg->timing._accept_pending = false;
+        timing_measure(cfg, pdb_timing_ps_transition,
+                now - cfg->timing._accept_time, PD_T_PS_TRANSITION);
+    }
+
+    /* New capabilities or a soft reset mean our next Request isn't a repeat
+     * of the one the source told us to wait with */
+    if ((msg_class == pdb_msg_data && type == PD_MSGTYPE_SOURCE_CAPABILITIES)
+            || (msg_class == pdb_msg_extended
+                && type == PD_MSGTYPE_EPR_SOURCE_CAPABILITIES)
+            || (msg_class == pdb_msg_control && type == PD_MSGTYPE_SOFT_RESET)) {
+        cfg->timing._wait_pending = false;
+    }
+
+    /* If we have to answer this message, start timing our response */
+    if (timing_rx_needs_response[msg_class] & PDB_TIMING_TYPE(type)) {
+        cfg->timing._rx_time = now;
+        cfg->timing._rx_pending = true;
+    }
+}
+
+void pdb_timing_tx(struct pdb_config *cfg, const union pd_msg *msg)
+{
+    uint64_t now = micros();
+    enum pdb_msg_class msg_class = PDB_MSG_CLASS_GET(msg);
+    uint8_t type = PD_MSGTYPE_GET(msg);
+    bool request = msg_class == pdb_msg_data
+        && (type == PD_MSGTYPE_REQUEST || type == PD_MSGTYPE_EPR_REQUEST);
+
+    /* The first thing we send after a message that needs a response is our
+     * response */
+    if (cfg->timing._rx_pending) {
+        cfg->timing._rx_pending = false;
+        timing_measure(cfg, pdb_timing_our_response,
+                now - cfg->timing._rx_time, PD_T_RECEIVER_RESPONSE);
+    }
+
+    /* Requests must be repeated often enough to keep a PPS or AVS contract */
+    if (request) {
+        /* ... but not too soon after the source told us to wait */
+        if (cfg->timing._wait_pending) {
+            cfg->timing._wait_pending = false;
+            timing_record(cfg, pdb_timing_sink_request,
+                    now - cfg->timing._wait_time,
+                    now - cfg->timing._wait_time < PD_T_SINK_REQUEST);
+        }
+        if (cfg->timing._request_valid && cfg->pe._explicit_contract
+                && cfg->pe._sink_apdo_timer_enabled) {
+            timing_measure(cfg, pdb_timing_pps_request,
+                    now - cfg->timing._request_time, PD_T_PPS_REQUEST);
+        }
+        cfg->timing._request_time = now;
+        cfg->timing._request_valid = true;
+    }
+
+    /* If the source has to answer this message, start timing its response */
+    cfg->timing._tx_pending = (timing_tx_needs_response[msg_class] & PDB_TIMING_TYPE(type)) != 0;
+    cfg->timing._tx_time = now;
+    cfg->timing._tx_request = request;
+    cfg->timing._accept_pending = false;
+}
+
+void pdb_timing_poll(struct pdb_config *cfg)
+{
+    uint64_t now = micros();
+
+    if (cfg->timing._poll_valid) {
+        timing_measure(cfg, pdb_timing_poll_gap, now - cfg->timing._poll_time,
+                PDB_T_POLL_MAX);
+    }
+    cfg->timing._poll_time = now;
+    cfg->timing._poll_valid = true;
+}
+
+uint32_t pdb_timing_violations(const struct pdb_config *cfg)
+{
+    uint32_t violations = 0;
+
+    for (uint8_t i = 0; i < PDB_TIMING_NUM_CHECKS; i++) {
+        violations += cfg->timing.checks[i].violations;
+    }
+    return violations;
+}
@@ -0,0 +1,48 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_TIMING_MONITOR_H
+#define PDB_TIMING_MONITOR_H
+
+#include <pdb.h>
+
+/*
+ * Start monitoring from scratch
+ */
+void pdb_timing_init(struct pdb_config *cfg);
+
+/*
+ * Forget any responses we were waiting for because of a hard reset
+ */
+void pdb_timing_hard_reset(struct pdb_config *cfg);
+
+/*
+ * Note that a message was received and passed to the Policy Engine
+ */
+void pdb_timing_rx(struct pdb_config *cfg, const union pd_msg *msg);
+
+/*
+ * Note that a message was given to the PHY to transmit
+ */
+void pdb_timing_tx(struct pdb_config *cfg, const union pd_msg *msg);
+
+/*
+ * Note that pdb_poll was called
+ */
+void pdb_timing_poll(struct pdb_config *cfg);
+
+#endif /* PDB_TIMING_MONITOR_H */
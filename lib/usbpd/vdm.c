@@ -0,0 +1,132 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "vdm.h"
+
+#include <stddef.h>
+
+#include <pd.h>
+
+
+/*
+ * Answer Discover Identity with our identity
+ */
+static bool vdm_discover_identity(struct pdb_config *cfg, union pd_msg *resp)
+{
+    const struct pdb_vdm_identity *id = cfg->vdm.identity;
+
+    if (id == NULL) {
+        return false;
+    }
+
+    /* ID Header VDO */
+    resp->obj[1] = id->product_type | PD_IDH_CONNECTOR_RECEPTACLE
+        | PD_IDH_VID_SET(id->vid);
+    if (id->usb_device) {
+        resp->obj[1] |= PD_IDH_USB_DEVICE;
+    }
+    if (cfg->vdm.num_handlers > 0) {
+        resp->obj[1] |= PD_IDH_MODAL;
+    }
+    /* Cert Stat VDO */
+    resp->obj[2] = id->xid;
+    /* Product VDO */
+    resp->obj[3] = PD_PRODUCT_PID_SET(id->pid) | PD_PRODUCT_BCD_DEVICE_SET(id->bcd_device);
+
+    resp->hdr |= PD_NUMOBJ(4);
+    return true;
+}
+
+/*
+ * Answer Discover SVIDs with the SVIDs we have handlers for
+ */
+static bool vdm_discover_svids(struct pdb_config *cfg, union pd_msg *resp)
+{
+    uint8_t n = cfg->vdm.num_handlers;
+
+    if (n == 0) {
+        return false;
+    }
+    /* Two SVIDs fit in each VDO, and we can send at most six VDOs.  The list
+     * ends with a zero SVID, so it has to fit too unless the list is full. */
+    if (n > 12) {
+        n = 12;
+    }
+
+    for (uint8_t i = 0; i < 6; i++) {
+        resp->obj[1 + i] = 0;
+    }
+    for (uint8_t i = 0; i < n; i++) {
+        uint32_t svid = cfg->vdm.handlers[i].svid;
+        resp->obj[1 + i / 2] |= (i % 2) ? svid : svid << 16;
+    }
+
+    uint8_t numobj = n / 2 + 1;
+    if (numobj > 6) {
+        numobj = 6;
+    }
+    resp->hdr |= PD_NUMOBJ(1 + numobj);
+    return true;
+}
+
+bool pdb_vdm_respond(struct pdb_config *cfg, const union pd_msg *req,
+        union pd_msg *resp)
+{
+    uint32_t vdmhdr = req->obj[0];
+
+    /* Only structured VDM requests get a response */
+    if (!(vdmhdr & PD_VDM_STRUCTURED)
+            || PD_VDM_CMDTYPE_GET(vdmhdr) != PD_VDM_CMDTYPE_REQ
+            || PD_VDM_CMD_GET(vdmhdr) == PD_VDM_CMD_ATTENTION) {
+        return false;
+    }
+
+    /* Start the response, echoing the request's SVID, object position and
+     * command */
+    resp->hdr = cfg->pe.hdr_template | PD_MSGTYPE_VENDOR_DEFINED;
+    resp->obj[0] = (vdmhdr & (PD_VDM_SVID | PD_VDM_OBJPOS | PD_VDM_CMD))
+        | PD_VDM_STRUCTURED
+        | (((cfg->pe.hdr_template & PD_HDR_SPECREV) == PD_SPECREV_3_0)
+                ? PD_VDM_VERSION_2_0 : PD_VDM_VERSION_1_0);
+
+    bool ack = false;
+    if (PD_VDM_SVID_GET(vdmhdr) == PD_SVID_PD_SID) {
+        if (PD_VDM_CMD_GET(vdmhdr) == PD_VDM_CMD_DISCOVER_IDENTITY) {
+            ack = vdm_discover_identity(cfg, resp);
+        } else if (PD_VDM_CMD_GET(vdmhdr) == PD_VDM_CMD_DISCOVER_SVIDS) {
+            ack = vdm_discover_svids(cfg, resp);
+        }
+        if (ack) {
+            resp->obj[0] |= PD_VDM_CMDTYPE_ACK;
+        }
+    } else {
+        /* Let the handler for the SVID answer, if we have one */
+        for (uint8_t i = 0; i < cfg->vdm.num_handlers; i++) {
+            if (cfg->vdm.handlers[i].svid == PD_VDM_SVID_GET(vdmhdr)) {
+                ack = cfg->vdm.handlers[i].handler(cfg, req, resp);
+                break;
+            }
+        }
+    }
+
+    /* If nobody could answer, NAK the request */
+    if (!ack) {
+        resp->hdr = (resp->hdr & ~PD_HDR_NUMOBJ) | PD_NUMOBJ(1);
+        resp->obj[0] = (resp->obj[0] & ~PD_VDM_CMDTYPE) | PD_VDM_CMDTYPE_NAK;
+    }
+    return true;
+}
@@ -0,0 +1,34 @@
+/*
+ * PD Buddy Firmware Library - USB Power Delivery for everyone
+ * Copyright 2017-2018 Clayton G. Hobbs
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PDB_VDM_RESPONDER_H
+#define PDB_VDM_RESPONDER_H
+
+#include <stdbool.h>
+
+#include <pdb.h>
+
+/*
+ * Make the response to a Vendor_Defined message
+ *
+ * Returns true if resp should be sent, or false if the message needs no
+ * response.
+ */
+bool pdb_vdm_respond(struct pdb_config *cfg, const union pd_msg *req,
+        union pd_msg *resp);
+
+#endif /* PDB_VDM_RESPONDER_H */